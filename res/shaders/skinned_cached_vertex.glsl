@@ -0,0 +1,23 @@
+#version 410 core
+
+// Draws vertices already skinned into the skinning cache, so any number of passes can reuse one pose
+layout (location = 0) in vec3 Position;
+layout (location = 1) in vec2 TexCoord;
+layout (location = 2) in vec3 Normal;
+
+out vec2 TexCoord0;
+out vec3 Normal0;
+out vec3 LocalPos0;
+flat out ivec4 BoneIDs0;
+out vec4 Weights0;
+
+uniform mat4 gWVP;
+
+void main() {
+    TexCoord0 = TexCoord;
+    Normal0 = Normal;
+    LocalPos0 = Position;
+    BoneIDs0 = ivec4(0);
+    Weights0 = vec4(0.0);
+    gl_Position = gWVP * vec4(Position, 1.0);
+}
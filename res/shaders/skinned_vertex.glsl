@@ -1,33 +1,101 @@
 #version 410 core
 
-layout (location = 0) in vec3 Position;
+// Influences per vertex, 1, 2, 4 or 8. SkinnedMesh compiles one variant per influence bucket.
+#ifndef NUM_INFLUENCES
+#define NUM_INFLUENCES 4
+#endif
+
+// SkinnedMesh::PackedSkinnedVertex, unpacked by the attribute formats and main
+layout (location = 0) in vec3 PackedPosition;
 layout (location = 1) in vec2 TexCoord;
-layout (location = 2) in vec3 Normal;
-layout (location = 3) in ivec4 BoneIDs;
+layout (location = 2) in vec2 PackedNormal;
+layout (location = 3) in uvec4 PackedBoneIDs;
 layout (location = 4) in vec4 Weights;
+#if NUM_INFLUENCES > 4
+// SkinnedMesh::PackedExtraInfluences
+layout (location = 5) in uvec4 PackedExtraBoneIDs;
+layout (location = 6) in vec4 ExtraWeights;
+#endif
 
 out vec2 TexCoord0;
 out vec3 Normal0;
 out vec3 LocalPos0;
 flat out ivec4 BoneIDs0;
 out vec4 Weights0;
+// Captured by transform feedback when this shader fills the skinning cache
+out vec3 SkinnedPosition;
+out vec3 SkinnedNormal;
 
-const int MAX_BONES = 200;
+// SkinnedMesh's MAX_BONES, the bones of one palette partition
+const int MAX_BONES = 64;
 
 uniform mat4 gWVP;
-uniform mat4 gBones[MAX_BONES];
+// Mesh bounds the packed positions are relative to
+uniform vec3 gPositionMin;
+uniform vec3 gPositionExtent;
+#ifdef INSTANCED
+// Variant drawing a whole crowd per draw call, gWVP is then the view projection. Each character's
+// world matrix and palette are fetched by gl_InstanceID from SkinnedMesh's buffers, as RGBA32F
+// texels. gPaletteBase is the first character's block of the partition drawn, gPaletteStride
+// the texels between characters, and gWorldBase the first character's world matrix.
+uniform samplerBuffer gPalettes;
+uniform samplerBuffer gInstanceWorlds;
+uniform int gPaletteBase;
+uniform int gPaletteStride;
+uniform int gWorldBase;
+
+mat3x4 GetBone(int BoneID) {
+    int Texel = gPaletteBase + gPaletteStride * gl_InstanceID + 3 * BoneID;
+    return mat3x4(texelFetch(gPalettes, Texel), texelFetch(gPalettes, Texel + 1), texelFetch(gPalettes, Texel + 2));
+}
+#else
+// Bound per character and mesh partition to its block of SkinnedMesh's palette buffer, indexed by
+// the partition's bone IDs. Affine bone transforms, the three rows of each in the three columns,
+// see AffineMatrix.
+layout (std140) uniform BonePalette {
+    mat3x4 gBones[MAX_BONES];
+};
+
+mat3x4 GetBone(int BoneID) {
+    return gBones[BoneID];
+}
+#endif
+
+vec3 OctDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0) v.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
 
 void main() {
-    mat4 BoneTransform = gBones[BoneIDs[0]] * Weights[0];
-    BoneTransform     += gBones[BoneIDs[1]] * Weights[1];
-    BoneTransform     += gBones[BoneIDs[2]] * Weights[2];
-    BoneTransform     += gBones[BoneIDs[3]] * Weights[3];
+    vec3 Position = gPositionMin + PackedPosition * gPositionExtent;
+    vec3 Normal = OctDecode(PackedNormal);
+    ivec4 BoneIDs = ivec4(PackedBoneIDs);
+
+    mat3x4 BoneTransform = GetBone(BoneIDs[0]) * Weights[0];
+    for (int i = 1 ; i < min(NUM_INFLUENCES, 4) ; i++) {
+        BoneTransform += GetBone(BoneIDs[i]) * Weights[i];
+    }
+#if NUM_INFLUENCES > 4
+    for (int i = 0 ; i < NUM_INFLUENCES - 4 ; i++) {
+        BoneTransform += GetBone(int(PackedExtraBoneIDs[i])) * ExtraWeights[i];
+    }
+#endif
 
-    vec4 PosL = BoneTransform * vec4(Position, 1.0);
+    vec4 PosL = vec4(vec4(Position, 1.0) * BoneTransform, 1.0);
+    SkinnedPosition = PosL.xyz;
+    SkinnedNormal = normalize(vec4(Normal, 0.0) * BoneTransform);
     TexCoord0 = TexCoord;
     Normal0 = Normal;
     LocalPos0 = Position;
     BoneIDs0 = BoneIDs;
     Weights0 = Weights;
+#ifdef INSTANCED
+    int World = gWorldBase + 4 * gl_InstanceID;
+    mat4 WorldMatrix = mat4(texelFetch(gInstanceWorlds, World), texelFetch(gInstanceWorlds, World + 1),
+                            texelFetch(gInstanceWorlds, World + 2), texelFetch(gInstanceWorlds, World + 3));
+    gl_Position = gWVP * WorldMatrix * PosL;
+#else
     gl_Position = gWVP * PosL;
+#endif
 }
\ No newline at end of file
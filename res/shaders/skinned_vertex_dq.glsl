@@ -0,0 +1,108 @@
+#version 410 core
+
+// Influences per vertex, 1, 2, 4 or 8. SkinnedMesh compiles one variant per influence bucket.
+#ifndef NUM_INFLUENCES
+#define NUM_INFLUENCES 4
+#endif
+
+// SkinnedMesh::PackedSkinnedVertex, unpacked by the attribute formats and main
+layout (location = 0) in vec3 PackedPosition;
+layout (location = 1) in vec2 TexCoord;
+layout (location = 2) in vec2 PackedNormal;
+layout (location = 3) in uvec4 PackedBoneIDs;
+layout (location = 4) in vec4 Weights;
+#if NUM_INFLUENCES > 4
+// SkinnedMesh::PackedExtraInfluences
+layout (location = 5) in uvec4 PackedExtraBoneIDs;
+layout (location = 6) in vec4 ExtraWeights;
+#endif
+
+out vec2 TexCoord0;
+out vec3 Normal0;
+out vec3 LocalPos0;
+flat out ivec4 BoneIDs0;
+out vec4 Weights0;
+// Captured by transform feedback when this shader fills the skinning cache
+out vec3 SkinnedPosition;
+out vec3 SkinnedNormal;
+
+// SkinnedMesh's MAX_BONES, the bones of one palette partition
+const int MAX_BONES = 64;
+
+uniform mat4 gWVP;
+// Mesh bounds the packed positions are relative to
+uniform vec3 gPositionMin;
+uniform vec3 gPositionExtent;
+#ifdef INSTANCED
+// Variant drawing a whole crowd per draw call, see skinned_vertex.glsl
+uniform samplerBuffer gPalettes;
+uniform samplerBuffer gInstanceWorlds;
+uniform int gPaletteBase;
+uniform int gPaletteStride;
+uniform int gWorldBase;
+
+mat2x4 GetDualQuat(int BoneID) {
+    int Texel = gPaletteBase + gPaletteStride * gl_InstanceID + 2 * BoneID;
+    return mat2x4(texelFetch(gPalettes, Texel), texelFetch(gPalettes, Texel + 1));
+}
+#else
+// Bound per character and mesh partition to its block of SkinnedMesh's palette buffer, indexed by
+// the partition's bone IDs. Unit dual quaternion per bone, [0] rotation and [1] dual part, both
+// (x, y, z, w).
+layout (std140) uniform BonePalette {
+    mat2x4 gDualQuats[MAX_BONES];
+};
+
+mat2x4 GetDualQuat(int BoneID) {
+    return gDualQuats[BoneID];
+}
+#endif
+
+vec3 OctDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0) v.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+void main() {
+    vec3 Position = gPositionMin + PackedPosition * gPositionExtent;
+    vec3 Normal = OctDecode(PackedNormal);
+    ivec4 BoneIDs = ivec4(PackedBoneIDs);
+
+    // Quaternions q and -q are the same rotation, flip influences into the first one's hemisphere
+    mat2x4 DQ0 = GetDualQuat(BoneIDs[0]);
+    mat2x4 Blended = DQ0 * Weights[0];
+    for (int i = 1 ; i < min(NUM_INFLUENCES, 4) ; i++) {
+        mat2x4 DQ = GetDualQuat(BoneIDs[i]);
+        Blended += DQ * (dot(DQ0[0], DQ[0]) < 0.0 ? -Weights[i] : Weights[i]);
+    }
+#if NUM_INFLUENCES > 4
+    for (int i = 0 ; i < NUM_INFLUENCES - 4 ; i++) {
+        mat2x4 DQ = GetDualQuat(int(PackedExtraBoneIDs[i]));
+        Blended += DQ * (dot(DQ0[0], DQ[0]) < 0.0 ? -ExtraWeights[i] : ExtraWeights[i]);
+    }
+#endif
+
+    float Norm = length(Blended[0]);
+    vec4 Real = Blended[0] / Norm;
+    vec4 Dual = Blended[1] / Norm;
+
+    vec3 PosL = Position + 2.0 * cross(Real.xyz, cross(Real.xyz, Position) + Real.w * Position);
+    PosL += 2.0 * (Real.w * Dual.xyz - Dual.w * Real.xyz + cross(Real.xyz, Dual.xyz));
+    SkinnedPosition = PosL;
+    SkinnedNormal = Normal + 2.0 * cross(Real.xyz, cross(Real.xyz, Normal) + Real.w * Normal);
+
+    TexCoord0 = TexCoord;
+    Normal0 = Normal;
+    LocalPos0 = Position;
+    BoneIDs0 = BoneIDs;
+    Weights0 = Weights;
+#ifdef INSTANCED
+    int World = gWorldBase + 4 * gl_InstanceID;
+    mat4 WorldMatrix = mat4(texelFetch(gInstanceWorlds, World), texelFetch(gInstanceWorlds, World + 1),
+                            texelFetch(gInstanceWorlds, World + 2), texelFetch(gInstanceWorlds, World + 3));
+    gl_Position = gWVP * WorldMatrix * vec4(PosL, 1.0);
+#else
+    gl_Position = gWVP * vec4(PosL, 1.0);
+#endif
+}
@@ -0,0 +1,100 @@
+#version 430 core
+
+// Fills the skinning cache on GL 4.3+. Same math as skinned_vertex.glsl and skinned_vertex_dq.glsl,
+// reading the vertex buffer and the palette as storage buffers.
+layout (local_size_x = 64) in;
+
+// Matches SkinnedMesh::PackedSkinnedVertex: unorm16 position and padding, snorm16 octahedral
+// normal, half float texture coordinates, uint8 bone IDs, unorm8 weights
+struct PackedSkinnedVertex {
+    uint Data[6];
+};
+
+// Matches the transform feedback layout, SkinnedPosition then SkinnedNormal
+struct CachedVertex {
+    float Position[3];
+    float Normal[3];
+};
+
+// Matches SkinnedMesh::PackedExtraInfluences, uint8 bone IDs then unorm8 weights of influences 4 to 7
+struct PackedExtraInfluences {
+    uint BoneIDs;
+    uint Weights;
+};
+
+layout (std430, binding = 0) readonly buffer Vertices { PackedSkinnedVertex gVertices[]; };
+layout (std430, binding = 1) writeonly buffer Cache { CachedVertex gCache[]; };
+// Three vec4 per bone for affine matrices, the rows of each, two for dual quaternions. Bound to one
+// partition of one character's slot of the same buffer the vertex shaders read as BonePalette.
+layout (std430, binding = 2) readonly buffer Palette { vec4 gPalette[]; };
+// Only bound, and only read, when gNumInfluences is above 4
+layout (std430, binding = 3) readonly buffer ExtraInfluences { PackedExtraInfluences gExtraInfluences[]; };
+
+// Vertices of the partition the palette binding belongs to
+uniform uint gBaseVertex;
+uniform uint gNumVertices;
+uniform bool gDualQuaternion;
+// The most influences any vertex has, rounded up to its bucket
+uniform uint gNumInfluences;
+// Mesh bounds the packed positions are relative to
+uniform vec3 gPositionMin;
+uniform vec3 gPositionExtent;
+
+vec3 OctDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0) v.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+void main() {
+    if (gl_GlobalInvocationID.x >= gNumVertices) return;
+    uint v = gBaseVertex + gl_GlobalInvocationID.x;
+
+    PackedSkinnedVertex Vertex = gVertices[v];
+    vec3 Position = gPositionMin + vec3(unpackUnorm2x16(Vertex.Data[0]), unpackUnorm2x16(Vertex.Data[1]).x) * gPositionExtent;
+    vec3 Normal = OctDecode(unpackSnorm2x16(Vertex.Data[2]));
+    uvec4 BoneIDs = (uvec4(Vertex.Data[4]) >> uvec4(0, 8, 16, 24)) & 0xFFu;
+    vec4 Weights = unpackUnorm4x8(Vertex.Data[5]);
+    uvec4 ExtraBoneIDs = uvec4(0u);
+    vec4 ExtraWeights = vec4(0.0);
+    if (gNumInfluences > 4u) {
+        PackedExtraInfluences Extra = gExtraInfluences[v];
+        ExtraBoneIDs = (uvec4(Extra.BoneIDs) >> uvec4(0, 8, 16, 24)) & 0xFFu;
+        ExtraWeights = unpackUnorm4x8(Extra.Weights);
+    }
+    uint NumInfluences = min(gNumInfluences, 8u);
+    vec3 SkinnedPosition, SkinnedNormal;
+
+    if (gDualQuaternion) {
+        uint Bone0 = BoneIDs[0];
+        vec4 First = gPalette[Bone0 * 2];
+        vec4 Real = vec4(0.0), Dual = vec4(0.0);
+        for (uint i = 0u ; i < NumInfluences ; i++) {
+            uint Bone = i < 4u ? BoneIDs[i] : ExtraBoneIDs[i - 4u];
+            float Weight = i < 4u ? Weights[i] : ExtraWeights[i - 4u];
+            vec4 BoneReal = gPalette[Bone * 2];
+            Weight = dot(First, BoneReal) < 0.0 ? -Weight : Weight;
+            Real += BoneReal * Weight;
+            Dual += gPalette[Bone * 2 + 1] * Weight;
+        }
+        float Norm = length(Real);
+        Real /= Norm;
+        Dual /= Norm;
+
+        SkinnedPosition = Position + 2.0 * cross(Real.xyz, cross(Real.xyz, Position) + Real.w * Position);
+        SkinnedPosition += 2.0 * (Real.w * Dual.xyz - Dual.w * Real.xyz + cross(Real.xyz, Dual.xyz));
+        SkinnedNormal = Normal + 2.0 * cross(Real.xyz, cross(Real.xyz, Normal) + Real.w * Normal);
+    } else {
+        mat3x4 BoneTransform = mat3x4(0.0);
+        for (uint i = 0u ; i < NumInfluences ; i++) {
+            uint Bone = i < 4u ? BoneIDs[i] : ExtraBoneIDs[i - 4u];
+            float Weight = i < 4u ? Weights[i] : ExtraWeights[i - 4u];
+            BoneTransform += mat3x4(gPalette[Bone * 3], gPalette[Bone * 3 + 1], gPalette[Bone * 3 + 2]) * Weight;
+        }
+        SkinnedPosition = vec4(Position, 1.0) * BoneTransform;
+        SkinnedNormal = normalize(vec4(Normal, 0.0) * BoneTransform);
+    }
+
+    gCache[v].Position = float[3](SkinnedPosition.x, SkinnedPosition.y, SkinnedPosition.z);
+    gCache[v].Normal = float[3](SkinnedNormal.x, SkinnedNormal.y, SkinnedNormal.z);
+}
@@ -0,0 +1,51 @@
+#include "allocationCounter.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+
+static std::atomic<size_t> s_Allocations{0};
+
+void* operator new(std::size_t Size) {
+    s_Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(Size != 0 ? Size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t Size) {
+    return ::operator new(Size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+#endif
+
+namespace gl {
+
+    size_t GetAllocationCount() {
+#ifndef NDEBUG
+        return s_Allocations.load(std::memory_order_relaxed);
+#else
+        return 0;
+#endif
+    }
+
+    void AllocationCheck::End() {
+        size_t Allocations = GetAllocationCount() - m_Start;
+        m_Scopes++;
+        if (m_Scopes <= m_WarmupScopes) return;
+
+        if (Allocations > 0) {
+            printf("%s allocated %zu times after %u clean runs\n", m_pName, Allocations, m_CleanScopes);
+            assert(0);
+        }
+        m_CleanScopes++;
+    }
+}
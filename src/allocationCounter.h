@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+namespace gl {
+    // Heap allocations made through the global operator new since startup, from any thread. Only
+    // counted in debug builds, which replace the default-aligned operator new and delete; release
+    // builds keep the standard operators and always return 0.
+    size_t GetAllocationCount();
+
+    // Asserts that a recurring scope, typically the animation and render part of a frame, stops
+    // allocating once warmed up. The first WarmupScopes scopes after construction or Reset() may
+    // allocate, any later one that does is reported and asserts.
+    class AllocationCheck {
+    public:
+        explicit AllocationCheck(const char* pName, unsigned int WarmupScopes = 8)
+            : m_pName(pName), m_WarmupScopes(WarmupScopes) {}
+
+        void Begin() { m_Start = GetAllocationCount(); }
+        void End();
+        // Call when the work in the scope changes, resizing buffers once is expected then
+        void Reset() { m_CleanScopes = 0; m_Scopes = 0; }
+
+    private:
+        const char* m_pName;
+        unsigned int m_WarmupScopes;
+        unsigned int m_Scopes = 0;
+        unsigned int m_CleanScopes = 0;
+        size_t m_Start = 0;
+    };
+}
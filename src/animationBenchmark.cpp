@@ -0,0 +1,358 @@
+#include "animationBenchmark.h"
+#include "animations/keyframes.h"
+#include "animations/compressedClip.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace gl {
+
+    // Sums the key indices so the lookups cannot be optimized away, and so both searches can be
+    // checked to agree
+    template<typename Function>
+    static double MeasureMs(const std::vector<float>& Times, unsigned long long& Checksum, const Function& Find) {
+        Checksum = 0;
+        auto Start = std::chrono::steady_clock::now();
+        for (float Time : Times) Checksum += Find(Time);
+        auto End = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(End - Start).count();
+    }
+
+    static void CompareLookups(const char* pName, const std::vector<aiVectorKey>& Keys,
+                               const std::vector<float>& Times) {
+        unsigned int NumKeys = (unsigned int)Keys.size();
+        unsigned long long LinearSum = 0, CursorSum = 0;
+        double LinearMs = MeasureMs(Times, LinearSum, [&](float Time) {
+            return FindKeyLinear(Time, Keys.data(), NumKeys);
+        });
+        unsigned int Cursor = 0;
+        double CursorMs = MeasureMs(Times, CursorSum, [&](float Time) {
+            return FindKey(Time, Keys.data(), NumKeys, Cursor);
+        });
+
+        double Samples = (double)Times.size();
+        printf("%-16s %8zu  %14.1f  %14.1f  %7.1fx%s\n", pName, Times.size(), LinearMs * 1.0e6 / Samples,
+               CursorMs * 1.0e6 / Samples, LinearMs / CursorMs, LinearSum == CursorSum ? "" : "  MISMATCH");
+    }
+
+    void RunKeyframeBenchmark(unsigned int NumKeys) {
+        constexpr float SAMPLES_PER_KEY = 4.0f;     // as when a 30 Hz clip is drawn at 120 Hz
+        constexpr unsigned int SCRUB_SAMPLES = 20000;
+
+        // Mocap-like spacing, one tick apart on average but irregular so no index can be computed
+        std::mt19937 Random(1950);
+        std::uniform_real_distribution<float> Spacing(0.5f, 1.5f);
+        std::vector<aiVectorKey> Keys(NumKeys);
+        double Time = 0.0;
+        for (unsigned int i = 0 ; i < NumKeys ; i++) {
+            Keys[i].mTime = Time;
+            Keys[i].mValue = aiVector3D((float)i, 0.0f, 0.0f);
+            Time += Spacing(Random);
+        }
+        float Duration = (float)Keys[NumKeys - 1].mTime;
+
+        std::vector<float> Forward;
+        float Step = Duration / ((float)NumKeys * SAMPLES_PER_KEY);
+        for (float t = 0.0f ; t < Duration ; t += Step) Forward.push_back(t);
+
+        std::vector<float> Scrub(SCRUB_SAMPLES);
+        std::uniform_real_distribution<float> AnyTime(0.0f, Duration);
+        for (float& t : Scrub) t = AnyTime(Random);
+
+        printf("Keyframe lookup on one channel of %u keys\n", NumKeys);
+        printf("access            samples  linear ns/find  cursor ns/find  speedup\n");
+        CompareLookups("forward playback", Keys, Forward);
+        CompareLookups("random scrubbing", Keys, Scrub);
+    }
+
+    // Poses each clip is evaluated at, spread over its duration
+    static constexpr unsigned int POSES_PER_CLIP = 200;
+
+    static glm::mat4 ToGlm(const aiMatrix4x4& m) {
+        return {
+            m.a1, m.b1, m.c1, m.d1,
+            m.a2, m.b2, m.c2, m.d2,
+            m.a3, m.b3, m.c3, m.d3,
+            m.a4, m.b4, m.c4, m.d4
+        };
+    }
+
+    // The node's animated local transform, the same math on both paths so only the lookup differs
+    static glm::mat4 SampleLocal(const aiNodeAnim* pNodeAnim, float AnimationTimeTicks, KeyCursor& Cursor) {
+        LocalTransform Transform;
+        CalcLocalTransform(Transform, AnimationTimeTicks, pNodeAnim, Cursor);
+        const aiQuaternion& q = Transform.Rotation;
+        glm::mat4 Rotation = glm::mat4_cast(glm::quat(q.w, q.x, q.y, q.z));
+        return glm::translate(glm::mat4(1.0f), glm::vec3(Transform.Translation.x, Transform.Translation.y,
+                                                         Transform.Translation.z)) *
+               Rotation * glm::scale(glm::mat4(1.0f), glm::vec3(Transform.Scaling.x, Transform.Scaling.y,
+                                                                 Transform.Scaling.z));
+    }
+
+    // The lookup ReadNodeHierarchy used to do for every node of every pose
+    static const aiNodeAnim* FindNodeAnim(const aiAnimation& Animation, const std::string& NodeName) {
+        for (unsigned int i = 0 ; i < Animation.mNumChannels ; i++) {
+            const aiNodeAnim* pNodeAnim = Animation.mChannels[i];
+            if (std::string(pNodeAnim->mNodeName.data) == NodeName) return pNodeAnim;
+        }
+        return nullptr;
+    }
+
+    // Recursive walk with a name scan per node, globals come out in depth-first order
+    static void EvaluateByName(const aiNode* pNode, const aiAnimation& Animation, float AnimationTimeTicks,
+                               const glm::mat4& ParentTransform, std::vector<KeyCursor>& Cursors,
+                               std::vector<glm::mat4>& Globals) {
+        std::string NodeName(pNode->mName.data);
+        unsigned int Index = (unsigned int)Globals.size();
+        glm::mat4 NodeTransformation = ToGlm(pNode->mTransformation);
+        const aiNodeAnim* pNodeAnim = FindNodeAnim(Animation, NodeName);
+        if (pNodeAnim) NodeTransformation = SampleLocal(pNodeAnim, AnimationTimeTicks, Cursors[Index]);
+
+        glm::mat4 GlobalTransformation = ParentTransform * NodeTransformation;
+        Globals.push_back(GlobalTransformation);
+        for (unsigned int i = 0 ; i < pNode->mNumChildren ; i++) {
+            EvaluateByName(pNode->mChildren[i], Animation, AnimationTimeTicks, GlobalTransformation, Cursors, Globals);
+        }
+    }
+
+    static void FlattenNodes(const aiNode* pNode, int Parent, std::vector<const aiNode*>& Nodes,
+                             std::vector<int>& Parents) {
+        int Index = (int)Nodes.size();
+        Nodes.push_back(pNode);
+        Parents.push_back(Parent);
+        for (unsigned int i = 0 ; i < pNode->mNumChildren ; i++) {
+            FlattenNodes(pNode->mChildren[i], Index, Nodes, Parents);
+        }
+    }
+
+    static float PoseTimeTicks(const aiAnimation& Animation, unsigned int Pose) {
+        return (float)(Animation.mDuration * (double)Pose / (double)POSES_PER_CLIP);
+    }
+
+    static void CompareChannelLookups(const aiScene* pScene) {
+        std::vector<const aiNode*> Nodes;
+        std::vector<int> Parents;
+        FlattenNodes(pScene->mRootNode, -1, Nodes, Parents);
+        unsigned int NumNodes = (unsigned int)Nodes.size();
+        unsigned int NumClips = pScene->mNumAnimations;
+
+        // What LoadMesh resolves once, the first channel wins on duplicate names as with the scan
+        auto TableStart = std::chrono::steady_clock::now();
+        std::vector<const aiNodeAnim*> Channels((size_t)NumClips * NumNodes, nullptr);
+        for (unsigned int a = 0 ; a < NumClips ; a++) {
+            for (unsigned int i = 0 ; i < NumNodes ; i++) {
+                Channels[(size_t)a * NumNodes + i] = FindNodeAnim(*pScene->mAnimations[a], Nodes[i]->mName.data);
+            }
+        }
+        auto TableEnd = std::chrono::steady_clock::now();
+
+        unsigned int NumChannels = 0;
+        for (unsigned int a = 0 ; a < NumClips ; a++) NumChannels += pScene->mAnimations[a]->mNumChannels;
+
+        std::vector<KeyCursor> Cursors(NumNodes);
+        std::vector<glm::mat4> ByName, ByTable(NumNodes);
+        ByName.reserve(NumNodes);
+        float MaxDiff = 0.0f;
+        double NameMs = 0.0, TableMs = 0.0;
+
+        for (unsigned int a = 0 ; a < NumClips ; a++) {
+            const aiAnimation& Animation = *pScene->mAnimations[a];
+            const aiNodeAnim* const* pClipChannels = Channels.data() + (size_t)a * NumNodes;
+
+            std::fill(Cursors.begin(), Cursors.end(), KeyCursor());
+            auto Start = std::chrono::steady_clock::now();
+            for (unsigned int p = 0 ; p < POSES_PER_CLIP ; p++) {
+                ByName.clear();
+                EvaluateByName(pScene->mRootNode, Animation, PoseTimeTicks(Animation, p), glm::mat4(1.0f), Cursors,
+                               ByName);
+            }
+            auto Middle = std::chrono::steady_clock::now();
+
+            std::fill(Cursors.begin(), Cursors.end(), KeyCursor());
+            for (unsigned int p = 0 ; p < POSES_PER_CLIP ; p++) {
+                float AnimationTimeTicks = PoseTimeTicks(Animation, p);
+                for (unsigned int i = 0 ; i < NumNodes ; i++) {
+                    glm::mat4 Local = pClipChannels[i] ? SampleLocal(pClipChannels[i], AnimationTimeTicks, Cursors[i])
+                                                       : ToGlm(Nodes[i]->mTransformation);
+                    ByTable[i] = Parents[i] >= 0 ? ByTable[Parents[i]] * Local : Local;
+                }
+            }
+            auto End = std::chrono::steady_clock::now();
+
+            NameMs += std::chrono::duration<double, std::milli>(Middle - Start).count();
+            TableMs += std::chrono::duration<double, std::milli>(End - Middle).count();
+            // Both hold the clip's last pose
+            for (unsigned int i = 0 ; i < NumNodes ; i++) {
+                for (int c = 0 ; c < 4 ; c++) {
+                    MaxDiff = std::max(MaxDiff, glm::length(ByName[i][c] - ByTable[i][c]));
+                }
+            }
+        }
+
+        double Poses = (double)NumClips * POSES_PER_CLIP;
+        printf("%u nodes, %u clips, %u channels, table built in %.3f ms\n", NumNodes, NumClips, NumChannels,
+               std::chrono::duration<double, std::milli>(TableEnd - TableStart).count());
+        printf("name scan %.2f us/pose, channel table %.2f us/pose, %.1fx faster (max difference %g)\n",
+               NameMs * 1000.0 / Poses, TableMs * 1000.0 / Poses, NameMs / TableMs, MaxDiff);
+    }
+
+    int RunChannelBenchmark(const std::vector<std::string>& Filenames) {
+        int Result = 0;
+        for (const std::string& Filename : Filenames) {
+            Assimp::Importer Importer;
+            // Same node hierarchy and channels as SkinnedMesh::LoadMesh sees, the meshes are not needed
+            const aiScene* pScene = Importer.ReadFile(Filename.c_str(),
+                                                      aiProcess_Triangulate | aiProcess_LimitBoneWeights);
+            printf("%s: ", Filename.c_str());
+            if (!pScene || pScene->mNumAnimations == 0) {
+                printf("could not load an animated scene\n");
+                Result = -1;
+                continue;
+            }
+            CompareChannelLookups(pScene);
+        }
+        return Result;
+    }
+
+    // Passes over each clip's sample times, enough to time the baked clips well above the clock resolution
+    static constexpr int CLIP_REPEATS = 20;
+
+    static glm::vec3 ToGlm(const aiVector3D& v) { return { v.x, v.y, v.z }; }
+
+    // Resampled as SkinnedMesh::BakeClips does, one track per channel
+    static void BakeAnimation(const aiAnimation& Animation, BakedClip& Clip, size_t& SourceBytes) {
+        float TicksPerSecond = (float)(Animation.mTicksPerSecond != 0 ? Animation.mTicksPerSecond : 25.0f);
+        float DurationSec = (float)Animation.mDuration / TicksPerSecond;
+        float SampleRate = ANIMATION_SAMPLE_RATE;
+        for (unsigned int c = 0 ; c < Animation.mNumChannels && DurationSec > 0.0f ; c++) {
+            const aiNodeAnim* pNodeAnim = Animation.mChannels[c];
+            unsigned int MaxKeys = std::max({ pNodeAnim->mNumPositionKeys, pNodeAnim->mNumRotationKeys,
+                                              pNodeAnim->mNumScalingKeys });
+            SampleRate = std::max(SampleRate, (float)(MaxKeys - 1) / DurationSec);
+        }
+        SampleRate = std::min(SampleRate, ANIMATION_MAX_SAMPLE_RATE);
+
+        Clip.Init(Animation.mNumChannels, (float)Animation.mDuration, TicksPerSecond, SampleRate);
+        SourceBytes = 0;
+        for (unsigned int t = 0 ; t < Animation.mNumChannels ; t++) {
+            const aiNodeAnim* pNodeAnim = Animation.mChannels[t];
+            SourceBytes += pNodeAnim->mNumPositionKeys * sizeof(aiVectorKey) +
+                           pNodeAnim->mNumRotationKeys * sizeof(aiQuatKey) +
+                           pNodeAnim->mNumScalingKeys * sizeof(aiVectorKey);
+            KeyCursor Cursor;
+            for (unsigned int f = 0 ; f < Clip.NumFrames() ; f++) {
+                LocalTransform Transform;
+                CalcLocalTransform(Transform, Clip.GetFrameTimeTicks(f), pNodeAnim, Cursor);
+                const aiQuaternion& q = Transform.Rotation;
+                Clip.SetKey(f, t, ToGlm(Transform.Translation), glm::quat(q.w, q.x, q.y, q.z),
+                            ToGlm(Transform.Scaling));
+            }
+        }
+    }
+
+    // The pose straight from the imported keys, what every frame sampled before clips were baked
+    static void SampleChannels(const aiAnimation& Animation, float AnimationTimeTicks, std::vector<KeyCursor>& Cursors,
+                               LocalPose& Pose) {
+        for (unsigned int t = 0 ; t < Animation.mNumChannels ; t++) {
+            LocalTransform Transform;
+            CalcLocalTransform(Transform, AnimationTimeTicks, Animation.mChannels[t], Cursors[t]);
+            const aiQuaternion& q = Transform.Rotation;
+            Pose.Translations[t] = ToGlm(Transform.Translation);
+            Pose.Rotations[t] = glm::quat(q.w, q.x, q.y, q.z);
+            Pose.Scales[t] = ToGlm(Transform.Scaling);
+        }
+    }
+
+    template<typename Function>
+    static double MeasureClipMs(const std::vector<float>& Times, const Function& Sample) {
+        auto Start = std::chrono::steady_clock::now();
+        for (int r = 0 ; r < CLIP_REPEATS ; r++) {
+            for (float Time : Times) Sample(Time);
+        }
+        auto End = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(End - Start).count();
+    }
+
+    int RunClipBenchmark(const std::string& Filename, float MaxPositionError, float MaxRotationError) {
+        Assimp::Importer Importer;
+        const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_LimitBoneWeights);
+        if (!pScene || pScene->mNumAnimations == 0) {
+            fprintf(stderr, "Could not load an animated scene from '%s'\n", Filename.c_str());
+            return -1;
+        }
+
+        printf("%s: %u clips, error bounds %g position, %g rad rotation\n", Filename.c_str(),
+               pScene->mNumAnimations, MaxPositionError, MaxRotationError);
+        printf("clip  tracks  aiNodeAnim B   baked B  compressed B  ratio   Mtracks/s: aiNodeAnim   baked  compressed"
+               "  max error\n");
+
+        for (unsigned int a = 0 ; a < pScene->mNumAnimations ; a++) {
+            const aiAnimation& Animation = *pScene->mAnimations[a];
+            unsigned int NumTracks = Animation.mNumChannels;
+            if (NumTracks == 0) continue;
+
+            BakedClip Baked;
+            size_t SourceBytes = 0;
+            BakeAnimation(Animation, Baked, SourceBytes);
+            CompressedClip Compressed;
+            bool IsCompressed = Compressed.Compress(Baked, MaxPositionError, MaxRotationError);
+
+            // Forward playback at every baked frame and halfway between, the same times for all three
+            std::vector<float> Times;
+            for (unsigned int f = 0 ; f + 1 < Baked.NumFrames() ; f++) {
+                Times.push_back(Baked.GetFrameTimeTicks(f));
+                Times.push_back(0.5f * (Baked.GetFrameTimeTicks(f) + Baked.GetFrameTimeTicks(f + 1)));
+            }
+            Times.push_back(Baked.GetFrameTimeTicks(Baked.NumFrames() - 1));
+
+            LocalPose Source, Pose;
+            Source.Resize(NumTracks);
+            Pose.Resize(NumTracks);
+            std::vector<KeyCursor> Cursors(NumTracks);
+            // The cursors carry over between passes, the jump back to the start is one binary search
+            double SourceMs = MeasureClipMs(Times, [&](float Time) {
+                SampleChannels(Animation, Time, Cursors, Source);
+            });
+            double BakedMs = MeasureClipMs(Times, [&](float Time) { Baked.SamplePose(Time, Pose, NumTracks); });
+            double CompressedMs = 0.0;
+            float MaxError = 0.0f;
+            if (IsCompressed) {
+                CompressedMs = MeasureClipMs(Times, [&](float Time) { Compressed.SamplePose(Time, Pose, NumTracks); });
+                // Position error against the imported keys, rotations are bounded inside Compress
+                std::fill(Cursors.begin(), Cursors.end(), KeyCursor());
+                for (float Time : Times) {
+                    SampleChannels(Animation, Time, Cursors, Source);
+                    Compressed.SamplePose(Time, Pose, NumTracks);
+                    for (unsigned int t = 0 ; t < NumTracks ; t++) {
+                        MaxError = std::max(MaxError, glm::length(Source.Translations[t] - Pose.Translations[t]));
+                    }
+                }
+            }
+
+            // Millions of tracks sampled per second
+            double Tracks = (double)Times.size() * CLIP_REPEATS * NumTracks;
+            auto Throughput = [Tracks](double Ms) { return Ms > 0.0 ? Tracks / (Ms * 1000.0) : 0.0; };
+            if (IsCompressed) {
+                printf("%4u  %6u  %12zu  %8zu  %12zu  %5.1fx  %20.1f  %6.1f  %10.1f  %9.5f\n", a, NumTracks,
+                       SourceBytes, Baked.MemoryBytes(), Compressed.MemoryBytes(),
+                       (double)SourceBytes / (double)std::max<size_t>(Compressed.MemoryBytes(), 1),
+                       Throughput(SourceMs), Throughput(BakedMs), Throughput(CompressedMs), MaxError);
+            } else {
+                printf("%4u  %6u  %12zu  %8zu  %12s  %6s  %20.1f  %6.1f  %10s\n", a, NumTracks, SourceBytes,
+                       Baked.MemoryBytes(), "too long", "-", Throughput(SourceMs), Throughput(BakedMs), "-");
+            }
+        }
+        return 0;
+    }
+}
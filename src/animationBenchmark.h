@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace gl {
+    // Keyframe lookup on one synthetic channel of NumKeys irregularly spaced keys, run with
+    // `viewer --keyframe-benchmark`. Times forward playback and random scrubbing through the
+    // cursor-cached FindKey against the linear scan from key 0 it replaced, and prints both.
+    void RunKeyframeBenchmark(unsigned int NumKeys = 20000);
+
+    // Channel lookup during pose evaluation on each model, run with `viewer --channel-benchmark
+    // [model.dae ...]`, by default on the bundled StrutWalking and hip_hop rigs. Evaluates every
+    // clip once with a FindNodeAnim name scan per node and once through a (clip, node) channel
+    // table resolved up front, and prints the time per pose of each.
+    int RunChannelBenchmark(const std::vector<std::string>& Filenames);
+
+    // Clip representations compared on one model, run with `viewer --clip-benchmark model.dae`.
+    // Bakes and compresses every clip as SkinnedMesh does with the viewer's default error bounds,
+    // then samples the same poses from the aiNodeAnim keys, the BakedClip and the CompressedClip.
+    // Prints the memory of each and the sampling throughput in tracks per second.
+    int RunClipBenchmark(const std::string& Filename, float MaxPositionError = 0.01f, float MaxRotationError = 0.002f);
+}
@@ -0,0 +1,131 @@
+#include "animationClip.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+float AnimationClip::TimeToFrame(float AnimationTimeTicks, float FramesPerTick, unsigned int NumFrames) const {
+    float Frame = std::max(AnimationTimeTicks, 0.0f) * FramesPerTick;
+    float LastInterval = (float)(NumFrames - 2);
+    if (Frame < LastInterval) return Frame;
+
+    float Start = LastInterval / FramesPerTick;
+    float Length = m_DurationTicks - Start;
+    if (Length <= 0.0f) return (float)(NumFrames - 1);
+    return LastInterval + std::min((AnimationTimeTicks - Start) / Length, 1.0f);
+}
+
+void BakedClip::Init(unsigned int NumTracks, float DurationTicks, float TicksPerSecond, float SampleRate) {
+    m_NumTracks = NumTracks;
+    m_DurationTicks = DurationTicks;
+    m_TicksPerSecond = TicksPerSecond;
+    m_FramesPerTick = SampleRate / TicksPerSecond;
+
+    // One frame past the end so the last interval always has a right-hand key to lerp towards
+    m_NumFrames = std::max(2u, (unsigned int)std::ceil(DurationTicks * m_FramesPerTick) + 1);
+
+    m_Translations.assign((size_t)m_NumFrames * NumTracks * 3, 0.0f);
+    m_Rotations.assign((size_t)m_NumFrames * NumTracks * 4, 0.0f);
+    m_Scales.assign((size_t)m_NumFrames * NumTracks * 3, 1.0f);
+}
+
+// The last frame is clamped to the duration, see TimeToFrame
+float BakedClip::GetFrameTimeTicks(unsigned int Frame) const {
+    return std::min((float)Frame / m_FramesPerTick, m_DurationTicks);
+}
+
+void BakedClip::SetKey(unsigned int Frame, unsigned int Track,
+                           const glm::vec3& Translation, const glm::quat& Rotation, const glm::vec3& Scale) {
+    assert(Frame < m_NumFrames && Track < m_NumTracks);
+    size_t Key = (size_t)Frame * m_NumTracks + Track;
+
+    float* pT = &m_Translations[Key * 3];
+    pT[0] = Translation.x; pT[1] = Translation.y; pT[2] = Translation.z;
+
+    // Keep consecutive keys in the same hemisphere so sampling can use a plain nlerp
+    glm::quat R = Rotation;
+    if (Frame > 0) {
+        const float* pPrev = &m_Rotations[(Key - m_NumTracks) * 4];
+        if (pPrev[0] * R.x + pPrev[1] * R.y + pPrev[2] * R.z + pPrev[3] * R.w < 0.0f) R = -R;
+    }
+    float* pR = &m_Rotations[Key * 4];
+    pR[0] = R.x; pR[1] = R.y; pR[2] = R.z; pR[3] = R.w;
+
+    float* pS = &m_Scales[Key * 3];
+    pS[0] = Scale.x; pS[1] = Scale.y; pS[2] = Scale.z;
+}
+
+void BakedClip::SampleTracks(float AnimationTimeTicks, LocalPose& Pose, unsigned int FirstTrack,
+                             unsigned int EndTrack) const {
+    Pose.Resize(m_NumTracks);
+    EndTrack = std::min(EndTrack, m_NumTracks);
+    if (FirstTrack >= EndTrack) return;
+
+    float Frame = TimeToFrame(AnimationTimeTicks, m_FramesPerTick, m_NumFrames);
+    unsigned int Frame0 = std::min((unsigned int)Frame, m_NumFrames - 2);
+    float Factor = std::clamp(Frame - (float)Frame0, 0.0f, 1.0f);
+
+    size_t Key0 = (size_t)Frame0 * m_NumTracks;
+    size_t Key1 = Key0 + m_NumTracks;
+
+    const float* pT0 = &m_Translations[Key0 * 3];
+    const float* pT1 = &m_Translations[Key1 * 3];
+    const float* pS0 = &m_Scales[Key0 * 3];
+    const float* pS1 = &m_Scales[Key1 * 3];
+    float* pT = &Pose.Translations[0].x;
+    float* pS = &Pose.Scales[0].x;
+    for (unsigned int i = FirstTrack * 3 ; i < EndTrack * 3 ; i++) {
+        pT[i] = pT0[i] + (pT1[i] - pT0[i]) * Factor;
+        pS[i] = pS0[i] + (pS1[i] - pS0[i]) * Factor;
+    }
+
+    const float* pR0 = &m_Rotations[Key0 * 4];
+    const float* pR1 = &m_Rotations[Key1 * 4];
+    for (unsigned int i = FirstTrack ; i < EndTrack ; i++) {
+        const float* a = &pR0[i * 4];
+        const float* b = &pR1[i * 4];
+        glm::quat q;
+        q.x = a[0] + (b[0] - a[0]) * Factor;
+        q.y = a[1] + (b[1] - a[1]) * Factor;
+        q.z = a[2] + (b[2] - a[2]) * Factor;
+        q.w = a[3] + (b[3] - a[3]) * Factor;
+        Pose.Rotations[i] = glm::normalize(q);
+    }
+}
+
+void BakedClip::ReorderTracks(const std::vector<unsigned int>& Order) {
+    assert(Order.size() == m_NumTracks);
+    std::vector<float> Translations(m_Translations.size()), Rotations(m_Rotations.size()), Scales(m_Scales.size());
+
+    for (unsigned int f = 0 ; f < m_NumFrames ; f++) {
+        size_t Frame = (size_t)f * m_NumTracks;
+        for (unsigned int t = 0 ; t < m_NumTracks ; t++) {
+            size_t To = Frame + t, From = Frame + Order[t];
+            std::copy_n(&m_Translations[From * 3], 3, &Translations[To * 3]);
+            std::copy_n(&m_Rotations[From * 4], 4, &Rotations[To * 4]);
+            std::copy_n(&m_Scales[From * 3], 3, &Scales[To * 3]);
+        }
+    }
+
+    m_Translations.swap(Translations);
+    m_Rotations.swap(Rotations);
+    m_Scales.swap(Scales);
+}
+
+size_t BakedClip::MemoryBytes() const {
+    return (m_Translations.size() + m_Rotations.size() + m_Scales.size()) * sizeof(float);
+}
+
+glm::vec3 BakedClip::GetTranslation(unsigned int Frame, unsigned int Track) const {
+    const float* p = &m_Translations[((size_t)Frame * m_NumTracks + Track) * 3];
+    return {p[0], p[1], p[2]};
+}
+
+glm::quat BakedClip::GetRotation(unsigned int Frame, unsigned int Track) const {
+    const float* p = &m_Rotations[((size_t)Frame * m_NumTracks + Track) * 4];
+    return {p[3], p[0], p[1], p[2]};
+}
+
+glm::vec3 BakedClip::GetScale(unsigned int Frame, unsigned int Track) const {
+    const float* p = &m_Scales[((size_t)Frame * m_NumTracks + Track) * 3];
+    return {p[0], p[1], p[2]};
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#define ANIMATION_SAMPLE_RATE 30.0f
+#define ANIMATION_MAX_SAMPLE_RATE 120.0f
+
+// Local transforms of every track of a clip at one point in time, stored structure-of-arrays
+struct LocalPose {
+    std::vector<glm::vec3> Translations;
+    std::vector<glm::quat> Rotations;
+    std::vector<glm::vec3> Scales;
+
+    void Resize(unsigned int NumTracks) {
+        Translations.resize(NumTracks);
+        Rotations.resize(NumTracks);
+        Scales.resize(NumTracks);
+    }
+};
+
+// Runtime representation of one animation. Track numbering is chosen by whoever builds the clip,
+// and every implementation samples a contiguous run of tracks of a pose in one call.
+class AnimationClip {
+public:
+    virtual ~AnimationClip() = default;
+
+    // Samples tracks [0, NumTracks) into Pose, which is sized for every track of the clip
+    void SamplePose(float AnimationTimeTicks, LocalPose& Pose, unsigned int NumTracks) const {
+        SampleTracks(AnimationTimeTicks, Pose, 0, NumTracks);
+    }
+    // As SamplePose for tracks [FirstTrack, EndTrack), the other tracks of Pose are left as they are
+    virtual void SampleTracks(float AnimationTimeTicks, LocalPose& Pose, unsigned int FirstTrack,
+                              unsigned int EndTrack) const = 0;
+    virtual size_t MemoryBytes() const = 0;
+
+    unsigned int NumTracks() const { return m_NumTracks; }
+    float DurationTicks() const { return m_DurationTicks; }
+    float TicksPerSecond() const { return m_TicksPerSecond; }
+
+protected:
+    // Where AnimationTimeTicks falls among NumFrames frames keyed every 1 / FramesPerTick ticks, in
+    // [0, NumFrames - 1]. The last frame is keyed at the duration, so the final interval is measured
+    // against its own length, which is shorter when the duration is not a whole number of frames.
+    float TimeToFrame(float AnimationTimeTicks, float FramesPerTick, unsigned int NumFrames) const;
+
+    unsigned int m_NumTracks = 0;
+    float m_DurationTicks = 0.0f;
+    float m_TicksPerSecond = 0.0f;
+};
+
+// An animation resampled at a fixed rate. Keys are stored frame-major and structure-of-arrays:
+// the translations, rotations and scales of all tracks at one frame are three contiguous runs of
+// floats, so sampling a full pose is a direct index computation plus a lerp between two adjacent
+// runs, with no key search and no per-track branching.
+class BakedClip : public AnimationClip {
+public:
+    void Init(unsigned int NumTracks, float DurationTicks, float TicksPerSecond, float SampleRate = ANIMATION_SAMPLE_RATE);
+    void SetKey(unsigned int Frame, unsigned int Track,
+                const glm::vec3& Translation, const glm::quat& Rotation, const glm::vec3& Scale);
+    void SampleTracks(float AnimationTimeTicks, LocalPose& Pose, unsigned int FirstTrack,
+                      unsigned int EndTrack) const override;
+    size_t MemoryBytes() const override;
+    // Renumbers the tracks, new track t holds what track Order[t] held
+    void ReorderTracks(const std::vector<unsigned int>& Order);
+
+    float GetFrameTimeTicks(unsigned int Frame) const;
+    unsigned int NumFrames() const { return m_NumFrames; }
+    float FramesPerTick() const { return m_FramesPerTick; }
+
+    glm::vec3 GetTranslation(unsigned int Frame, unsigned int Track) const;
+    glm::quat GetRotation(unsigned int Frame, unsigned int Track) const;
+    glm::vec3 GetScale(unsigned int Frame, unsigned int Track) const;
+
+private:
+    unsigned int m_NumFrames = 0;
+    float m_FramesPerTick = 0.0f;
+
+    std::vector<float> m_Translations; // [frame][track][xyz]
+    std::vector<float> m_Rotations;    // [frame][track][xyzw]
+    std::vector<float> m_Scales;       // [frame][track][xyz]
+};
@@ -0,0 +1,19 @@
+#include "animationClock.h"
+
+double AnimationClock::Tick() {
+    auto Now = std::chrono::steady_clock::now();
+    // Wall time is always consumed, so leaving pause or fixed-step mode does not jump ahead
+    double Elapsed = std::chrono::duration<double>(Now - m_LastTick).count();
+    m_LastTick = Now;
+
+    double Step = m_FixedStep > 0.0 ? m_FixedStep : Elapsed;
+    m_DeltaTime = m_Paused ? 0.0 : Step * m_TimeScale;
+    m_Time += m_DeltaTime;
+    return m_DeltaTime;
+}
+
+void AnimationClock::Reset(double Time) {
+    m_LastTick = std::chrono::steady_clock::now();
+    m_Time = Time;
+    m_DeltaTime = 0.0;
+}
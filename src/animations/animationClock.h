@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+
+// Source of animation time, in double seconds so playback stays smooth in long sessions. In real
+// time mode each Tick advances by the steady clock time since the previous one. In fixed-step
+// mode each Tick advances by exactly the step whatever the wall time, so a run driven by it is
+// reproducible frame for frame. Pause and time scale apply in both modes.
+class AnimationClock {
+public:
+    AnimationClock() { Reset(); }
+
+    // Advances the clock once per frame and returns the animation time delta, 0 while paused
+    double Tick();
+    double GetTime() const { return m_Time; }
+    double GetDeltaTime() const { return m_DeltaTime; }
+    void Reset(double Time = 0.0);
+
+    void SetPaused(bool Paused) { m_Paused = Paused; }
+    bool IsPaused() const { return m_Paused; }
+    void SetTimeScale(double Scale) { m_TimeScale = Scale; }
+    double GetTimeScale() const { return m_TimeScale; }
+    // A step above 0 turns on fixed-step mode, 0 goes back to real time
+    void SetFixedStep(double StepSeconds) { m_FixedStep = StepSeconds; }
+    double GetFixedStep() const { return m_FixedStep; }
+
+private:
+    std::chrono::steady_clock::time_point m_LastTick;
+    double m_Time = 0.0;
+    double m_DeltaTime = 0.0;
+    double m_TimeScale = 1.0;
+    double m_FixedStep = 0.0;
+    bool m_Paused = false;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+// One clip of the base blend
+struct BlendInput {
+    unsigned int AnimationIndex = 0;
+    float Weight = 0.0f;
+
+    bool operator==(const BlendInput&) const = default;
+};
+
+enum class BlendLayerMode {
+    Override,   // blends from the pose below towards the clip
+    Additive,   // adds the clip's motion relative to its first frame to the pose below
+};
+
+// One clip applied on top of the base blend, restricted to the bones of a mask
+struct BlendLayer {
+    unsigned int AnimationIndex = 0;
+    float Weight = 0.0f;
+    BlendLayerMode Mode = BlendLayerMode::Override;
+    int Mask = -1;  // from SkinnedMesh::CreateBoneMask, -1 covers every bone
+
+    bool operator==(const BlendLayer&) const = default;
+};
+
+// A blend tree flattened to the clips it samples. Nested weighted blends collapse into base
+// inputs weighted by the product of the weights along their path, so any tree of linear blends
+// is one list. The inputs are normalized per bone, then the layers apply in order. Inputs and
+// layers with a zero weight are never sampled, and a clip that does not animate a bone
+// contributes its bind pose there.
+struct BlendTree {
+    std::vector<BlendInput> Inputs;
+    std::vector<BlendLayer> Layers;
+
+    bool operator==(const BlendTree&) const = default;
+
+    void Clear() {
+        Inputs.clear();
+        Layers.clear();
+    }
+
+    BlendTree& AddInput(unsigned int AnimationIndex, float Weight) {
+        Inputs.push_back({ AnimationIndex, Weight });
+        return *this;
+    }
+
+    BlendTree& AddLayer(unsigned int AnimationIndex, float Weight, BlendLayerMode Mode, int Mask = -1) {
+        Layers.push_back({ AnimationIndex, Weight, Mode, Mask });
+        return *this;
+    }
+};
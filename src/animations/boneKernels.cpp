@@ -0,0 +1,419 @@
+#include "boneKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BONE_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+void NodeTRS::Resize(unsigned int Count) {
+    unsigned int Padded = (Count + BONE_BATCH_WIDTH - 1) / BONE_BATCH_WIDTH * BONE_BATCH_WIDTH;
+    for (auto* v : { &Tx, &Ty, &Tz, &Qx, &Qy, &Qz, &Sx, &Sy, &Sz }) v->resize(Padded, 0.0f);
+    Qw.resize(Padded, 1.0f);
+}
+
+void SkinningVertices::Resize(unsigned int Count, unsigned int Influences) {
+    NumInfluences = Influences;
+    for (auto* v : { &Px, &Py, &Pz, &Nx, &Ny, &Nz }) v->resize(Count, 0.0f);
+    for (unsigned int k = 0 ; k < SKIN_INFLUENCES ; k++) {
+        BoneIDs[k].resize(k < NumInfluences ? Count : 0, 0);
+        Weights[k].resize(k < NumInfluences ? Count : 0, 0.0f);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scalar fallback
+
+// Internal compose routines take a starting node so a wider kernel can hand its tail to a narrower one
+static void ComposeLocalsScalar(const NodeTRS& L, unsigned int Begin, unsigned int Count, glm::mat4* pOut) {
+    for (unsigned int i = Begin ; i < Count ; i++) {
+        float x = L.Qx[i], y = L.Qy[i], z = L.Qz[i], w = L.Qw[i];
+        glm::mat4& m = pOut[i];
+        m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * L.Sx[i];
+        m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * L.Sy[i];
+        m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * L.Sz[i];
+        m[3] = glm::vec4(L.Tx[i], L.Ty[i], L.Tz[i], 1.0f);
+    }
+}
+
+static void ConcatenateGlobalsScalar(const int* pParents, const glm::mat4* pLocals, unsigned int Count, glm::mat4* pGlobals) {
+    for (unsigned int i = 0 ; i < Count ; i++) {
+        pGlobals[i] = pParents[i] < 0 ? pLocals[i] : pGlobals[pParents[i]] * pLocals[i];
+    }
+}
+
+static void ComputePaletteScalar(const glm::mat4& GlobalInverse, const glm::mat4* pGlobals, const int* pBoneNodes,
+                                 const glm::mat4* pOffsets, unsigned int NumBones, AffineMatrix* pPalette) {
+    for (unsigned int b = 0 ; b < NumBones ; b++) {
+        if (pBoneNodes[b] < 0) continue;
+        pPalette[b] = ToAffine(GlobalInverse * pGlobals[pBoneNodes[b]] * pOffsets[b]);
+    }
+}
+
+static void SkinVerticesScalar(const AffineMatrix* pPalette, const SkinningVertices& V, unsigned int Begin,
+                               unsigned int End, float* pOut) {
+    for (unsigned int i = Begin ; i < End ; i++) {
+        AffineMatrix BoneTransform(0.0f);
+        for (unsigned int k = 0 ; k < V.NumInfluences ; k++) {
+            BoneTransform += pPalette[V.BoneIDs[k][i]] * V.Weights[k][i];
+        }
+        glm::vec3 Position = glm::vec4(V.Px[i], V.Py[i], V.Pz[i], 1.0f) * BoneTransform;
+        glm::vec3 Normal = glm::vec4(V.Nx[i], V.Ny[i], V.Nz[i], 0.0f) * BoneTransform;
+        float Length = glm::length(Normal);
+        if (Length > 0.0f) Normal = Normal / Length;
+
+        float* pVertex = pOut + 6 * (size_t)i;
+        pVertex[0] = Position.x; pVertex[1] = Position.y; pVertex[2] = Position.z;
+        pVertex[3] = Normal.x; pVertex[4] = Normal.y; pVertex[5] = Normal.z;
+    }
+}
+
+#ifdef BONE_KERNELS_X86
+// ------------------------------------------------------------------------------------------------
+// SSE2, 4 nodes per batch. The quaternion-to-matrix math runs lane-per-node, then 4x4 transposes
+// turn the per-element registers back into per-node matrix columns.
+
+static inline void StoreColumns4(__m128 r0, __m128 r1, __m128 r2, __m128 r3, glm::mat4* pOut, int Column) {
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(&pOut[0][Column][0], r0);
+    _mm_storeu_ps(&pOut[1][Column][0], r1);
+    _mm_storeu_ps(&pOut[2][Column][0], r2);
+    _mm_storeu_ps(&pOut[3][Column][0], r3);
+}
+
+static void ComposeLocalsSSE(const NodeTRS& L, unsigned int Begin, unsigned int Count, glm::mat4* pOut) {
+    const __m128 One = _mm_set1_ps(1.0f);
+    const __m128 Two = _mm_set1_ps(2.0f);
+    const __m128 Zero = _mm_setzero_ps();
+
+    unsigned int i = Begin;
+    for ( ; i + 4 <= Count ; i += 4) {
+        __m128 x = _mm_loadu_ps(&L.Qx[i]), y = _mm_loadu_ps(&L.Qy[i]);
+        __m128 z = _mm_loadu_ps(&L.Qz[i]), w = _mm_loadu_ps(&L.Qw[i]);
+        __m128 sx = _mm_loadu_ps(&L.Sx[i]), sy = _mm_loadu_ps(&L.Sy[i]), sz = _mm_loadu_ps(&L.Sz[i]);
+
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        __m128 m00 = _mm_mul_ps(_mm_sub_ps(One, _mm_mul_ps(Two, _mm_add_ps(yy, zz))), sx);
+        __m128 m01 = _mm_mul_ps(_mm_mul_ps(Two, _mm_add_ps(xy, wz)), sx);
+        __m128 m02 = _mm_mul_ps(_mm_mul_ps(Two, _mm_sub_ps(xz, wy)), sx);
+        __m128 m10 = _mm_mul_ps(_mm_mul_ps(Two, _mm_sub_ps(xy, wz)), sy);
+        __m128 m11 = _mm_mul_ps(_mm_sub_ps(One, _mm_mul_ps(Two, _mm_add_ps(xx, zz))), sy);
+        __m128 m12 = _mm_mul_ps(_mm_mul_ps(Two, _mm_add_ps(yz, wx)), sy);
+        __m128 m20 = _mm_mul_ps(_mm_mul_ps(Two, _mm_add_ps(xz, wy)), sz);
+        __m128 m21 = _mm_mul_ps(_mm_mul_ps(Two, _mm_sub_ps(yz, wx)), sz);
+        __m128 m22 = _mm_mul_ps(_mm_sub_ps(One, _mm_mul_ps(Two, _mm_add_ps(xx, yy))), sz);
+
+        StoreColumns4(m00, m01, m02, Zero, pOut + i, 0);
+        StoreColumns4(m10, m11, m12, Zero, pOut + i, 1);
+        StoreColumns4(m20, m21, m22, Zero, pOut + i, 2);
+        StoreColumns4(_mm_loadu_ps(&L.Tx[i]), _mm_loadu_ps(&L.Ty[i]), _mm_loadu_ps(&L.Tz[i]), One, pOut + i, 3);
+    }
+
+    ComposeLocalsScalar(L, i, Count, pOut);
+}
+
+// Out = A * B for column-major 4x4 matrices; Out may alias B but not A
+static inline void MulMat4SSE(const glm::mat4& A, const glm::mat4& B, glm::mat4& Out) {
+    __m128 a0 = _mm_loadu_ps(&A[0][0]), a1 = _mm_loadu_ps(&A[1][0]);
+    __m128 a2 = _mm_loadu_ps(&A[2][0]), a3 = _mm_loadu_ps(&A[3][0]);
+    for (int c = 0 ; c < 4 ; c++) {
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(B[c][0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(B[c][1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(B[c][2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(B[c][3])));
+        _mm_storeu_ps(&Out[c][0], r);
+    }
+}
+
+static void ConcatenateGlobalsSSE(const int* pParents, const glm::mat4* pLocals, unsigned int Count, glm::mat4* pGlobals) {
+    for (unsigned int i = 0 ; i < Count ; i++) {
+        if (pParents[i] < 0) pGlobals[i] = pLocals[i];
+        else MulMat4SSE(pGlobals[pParents[i]], pLocals[i], pGlobals[i]);
+    }
+}
+
+// Out = ToAffine(m), the transpose keeps the first three rows
+static inline void StoreAffineSSE(const glm::mat4& m, AffineMatrix& Out) {
+    __m128 c0 = _mm_loadu_ps(&m[0][0]), c1 = _mm_loadu_ps(&m[1][0]);
+    __m128 c2 = _mm_loadu_ps(&m[2][0]), c3 = _mm_loadu_ps(&m[3][0]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(&Out[0][0], c0);
+    _mm_storeu_ps(&Out[1][0], c1);
+    _mm_storeu_ps(&Out[2][0], c2);
+}
+
+static void ComputePaletteSSE(const glm::mat4& GlobalInverse, const glm::mat4* pGlobals, const int* pBoneNodes,
+                              const glm::mat4* pOffsets, unsigned int NumBones, AffineMatrix* pPalette) {
+    glm::mat4 Temp;
+    for (unsigned int b = 0 ; b < NumBones ; b++) {
+        if (pBoneNodes[b] < 0) continue;
+        MulMat4SSE(pGlobals[pBoneNodes[b]], pOffsets[b], Temp);
+        MulMat4SSE(GlobalInverse, Temp, Temp);
+        StoreAffineSSE(Temp, pPalette[b]);
+    }
+}
+
+// Writes lanes [0, Count) of the six per-attribute registers as interleaved vertices
+static inline void StoreSkinnedVertices(const float (&Lanes)[6][8], unsigned int Count, float* pOut) {
+    for (unsigned int j = 0 ; j < Count ; j++) {
+        for (int a = 0 ; a < 6 ; a++) pOut[6 * j + a] = Lanes[a][j];
+    }
+}
+
+// Blends 4 vertices at once. SSE2 has no gather, so the 12 elements of each influence's matrices
+// are assembled lane by lane.
+static void SkinVerticesSSE(const AffineMatrix* pPalette, const SkinningVertices& V, unsigned int Begin,
+                            unsigned int End, float* pOut) {
+    unsigned int i = Begin;
+    for ( ; i + 4 <= End ; i += 4) {
+        __m128 m[12];
+        for (auto& e : m) e = _mm_setzero_ps();
+
+        for (unsigned int k = 0 ; k < V.NumInfluences ; k++) {
+            const float* p0 = &pPalette[V.BoneIDs[k][i]][0][0];
+            const float* p1 = &pPalette[V.BoneIDs[k][i + 1]][0][0];
+            const float* p2 = &pPalette[V.BoneIDs[k][i + 2]][0][0];
+            const float* p3 = &pPalette[V.BoneIDs[k][i + 3]][0][0];
+            __m128 w = _mm_loadu_ps(&V.Weights[k][i]);
+            for (int c = 0 ; c < 4 ; c++) {
+                for (int r = 0 ; r < 3 ; r++) {
+                    int o = r * 4 + c;
+                    m[c * 3 + r] = _mm_add_ps(m[c * 3 + r], _mm_mul_ps(_mm_setr_ps(p0[o], p1[o], p2[o], p3[o]), w));
+                }
+            }
+        }
+
+        __m128 px = _mm_loadu_ps(&V.Px[i]), py = _mm_loadu_ps(&V.Py[i]), pz = _mm_loadu_ps(&V.Pz[i]);
+        __m128 nx = _mm_loadu_ps(&V.Nx[i]), ny = _mm_loadu_ps(&V.Ny[i]), nz = _mm_loadu_ps(&V.Nz[i]);
+        __m128 Out[6];
+        for (int r = 0 ; r < 3 ; r++) {
+            __m128 Rotated = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r], px), _mm_mul_ps(m[3 + r], py)), _mm_mul_ps(m[6 + r], pz));
+            Out[r] = _mm_add_ps(Rotated, m[9 + r]);
+            Out[3 + r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r], nx), _mm_mul_ps(m[3 + r], ny)), _mm_mul_ps(m[6 + r], nz));
+        }
+        __m128 Length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Out[3], Out[3]), _mm_mul_ps(Out[4], Out[4])), _mm_mul_ps(Out[5], Out[5]));
+        // Zero normals, from vertices without weights, stay zero instead of turning into NaN
+        __m128 InvLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(Length2, _mm_set1_ps(1e-30f))));
+
+        float Lanes[6][8];
+        for (int a = 0 ; a < 6 ; a++) _mm_storeu_ps(Lanes[a], a < 3 ? Out[a] : _mm_mul_ps(Out[a], InvLength));
+        StoreSkinnedVertices(Lanes, 4, pOut + 6 * (size_t)i);
+    }
+
+    SkinVerticesScalar(pPalette, V, i, End, pOut);
+}
+
+// ------------------------------------------------------------------------------------------------
+// AVX2 + FMA, 8 nodes per batch for the locals and two matrix columns per instruction for the
+// products. Each 8-wide element register is split into two 4x4 transposes on store.
+
+TARGET_AVX2 static inline void StoreColumns8(__m256 r0, __m256 r1, __m256 r2, __m256 r3, glm::mat4* pOut, int Column) {
+    StoreColumns4(_mm256_castps256_ps128(r0), _mm256_castps256_ps128(r1),
+                  _mm256_castps256_ps128(r2), _mm256_castps256_ps128(r3), pOut, Column);
+    StoreColumns4(_mm256_extractf128_ps(r0, 1), _mm256_extractf128_ps(r1, 1),
+                  _mm256_extractf128_ps(r2, 1), _mm256_extractf128_ps(r3, 1), pOut + 4, Column);
+}
+
+TARGET_AVX2 static void ComposeLocalsAVX2(const NodeTRS& L, unsigned int Begin, unsigned int Count, glm::mat4* pOut) {
+    const __m256 One = _mm256_set1_ps(1.0f);
+    const __m256 Two = _mm256_set1_ps(2.0f);
+    const __m256 Zero = _mm256_setzero_ps();
+
+    unsigned int i = Begin;
+    for ( ; i + 8 <= Count ; i += 8) {
+        __m256 x = _mm256_loadu_ps(&L.Qx[i]), y = _mm256_loadu_ps(&L.Qy[i]);
+        __m256 z = _mm256_loadu_ps(&L.Qz[i]), w = _mm256_loadu_ps(&L.Qw[i]);
+        __m256 sx = _mm256_loadu_ps(&L.Sx[i]), sy = _mm256_loadu_ps(&L.Sy[i]), sz = _mm256_loadu_ps(&L.Sz[i]);
+
+        __m256 x2 = _mm256_mul_ps(x, Two), y2 = _mm256_mul_ps(y, Two), z2 = _mm256_mul_ps(z, Two);
+        __m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+        __m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+        __m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+        __m256 m00 = _mm256_mul_ps(_mm256_sub_ps(One, _mm256_add_ps(yy, zz)), sx);
+        __m256 m01 = _mm256_mul_ps(_mm256_add_ps(xy, wz), sx);
+        __m256 m02 = _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx);
+        __m256 m10 = _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy);
+        __m256 m11 = _mm256_mul_ps(_mm256_sub_ps(One, _mm256_add_ps(xx, zz)), sy);
+        __m256 m12 = _mm256_mul_ps(_mm256_add_ps(yz, wx), sy);
+        __m256 m20 = _mm256_mul_ps(_mm256_add_ps(xz, wy), sz);
+        __m256 m21 = _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz);
+        __m256 m22 = _mm256_mul_ps(_mm256_sub_ps(One, _mm256_add_ps(xx, yy)), sz);
+
+        StoreColumns8(m00, m01, m02, Zero, pOut + i, 0);
+        StoreColumns8(m10, m11, m12, Zero, pOut + i, 1);
+        StoreColumns8(m20, m21, m22, Zero, pOut + i, 2);
+        StoreColumns8(_mm256_loadu_ps(&L.Tx[i]), _mm256_loadu_ps(&L.Ty[i]), _mm256_loadu_ps(&L.Tz[i]), One, pOut + i, 3);
+    }
+
+    ComposeLocalsSSE(L, i, Count, pOut);
+}
+
+// Out = A * B, computing two result columns per 256-bit register
+TARGET_AVX2 static inline void MulMat4AVX2(const glm::mat4& A, const glm::mat4& B, glm::mat4& Out) {
+    __m256 a0 = _mm256_broadcast_ps((const __m128*)&A[0][0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128*)&A[1][0]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128*)&A[2][0]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128*)&A[3][0]);
+    for (int c = 0 ; c < 4 ; c += 2) {
+        __m256 r = _mm256_mul_ps(a0, _mm256_setr_m128(_mm_set1_ps(B[c][0]), _mm_set1_ps(B[c + 1][0])));
+        r = _mm256_fmadd_ps(a1, _mm256_setr_m128(_mm_set1_ps(B[c][1]), _mm_set1_ps(B[c + 1][1])), r);
+        r = _mm256_fmadd_ps(a2, _mm256_setr_m128(_mm_set1_ps(B[c][2]), _mm_set1_ps(B[c + 1][2])), r);
+        r = _mm256_fmadd_ps(a3, _mm256_setr_m128(_mm_set1_ps(B[c][3]), _mm_set1_ps(B[c + 1][3])), r);
+        _mm256_storeu_ps(&Out[c][0], r);
+    }
+}
+
+TARGET_AVX2 static void ConcatenateGlobalsAVX2(const int* pParents, const glm::mat4* pLocals, unsigned int Count,
+                                               glm::mat4* pGlobals) {
+    for (unsigned int i = 0 ; i < Count ; i++) {
+        if (pParents[i] < 0) pGlobals[i] = pLocals[i];
+        else MulMat4AVX2(pGlobals[pParents[i]], pLocals[i], pGlobals[i]);
+    }
+}
+
+TARGET_AVX2 static void ComputePaletteAVX2(const glm::mat4& GlobalInverse, const glm::mat4* pGlobals, const int* pBoneNodes,
+                                           const glm::mat4* pOffsets, unsigned int NumBones, AffineMatrix* pPalette) {
+    glm::mat4 Temp;
+    for (unsigned int b = 0 ; b < NumBones ; b++) {
+        if (pBoneNodes[b] < 0) continue;
+        MulMat4AVX2(pGlobals[pBoneNodes[b]], pOffsets[b], Temp);
+        MulMat4AVX2(GlobalInverse, Temp, Temp);
+        StoreAffineSSE(Temp, pPalette[b]);
+    }
+}
+
+// Blends 8 vertices at once, gathering the 12 elements of each influence's matrices
+TARGET_AVX2 static void SkinVerticesAVX2(const AffineMatrix* pPalette, const SkinningVertices& V, unsigned int Begin,
+                                         unsigned int End, float* pOut) {
+    const float* pBase = &pPalette[0][0][0];
+
+    unsigned int i = Begin;
+    for ( ; i + 8 <= End ; i += 8) {
+        __m256 m[12];
+        for (auto& e : m) e = _mm256_setzero_ps();
+
+        for (unsigned int k = 0 ; k < V.NumInfluences ; k++) {
+            __m256i BoneIDs = _mm256_loadu_si256((const __m256i*)&V.BoneIDs[k][i]);
+            __m256i Offsets = _mm256_mullo_epi32(BoneIDs, _mm256_set1_epi32(12));
+            __m256 w = _mm256_loadu_ps(&V.Weights[k][i]);
+            for (int c = 0 ; c < 4 ; c++) {
+                for (int r = 0 ; r < 3 ; r++) {
+                    __m256 e = _mm256_i32gather_ps(pBase + r * 4 + c, Offsets, 4);
+                    m[c * 3 + r] = _mm256_fmadd_ps(e, w, m[c * 3 + r]);
+                }
+            }
+        }
+
+        __m256 px = _mm256_loadu_ps(&V.Px[i]), py = _mm256_loadu_ps(&V.Py[i]), pz = _mm256_loadu_ps(&V.Pz[i]);
+        __m256 nx = _mm256_loadu_ps(&V.Nx[i]), ny = _mm256_loadu_ps(&V.Ny[i]), nz = _mm256_loadu_ps(&V.Nz[i]);
+        __m256 Out[6];
+        for (int r = 0 ; r < 3 ; r++) {
+            Out[r] = _mm256_fmadd_ps(m[r], px, _mm256_fmadd_ps(m[3 + r], py, _mm256_fmadd_ps(m[6 + r], pz, m[9 + r])));
+            Out[3 + r] = _mm256_fmadd_ps(m[r], nx, _mm256_fmadd_ps(m[3 + r], ny, _mm256_mul_ps(m[6 + r], nz)));
+        }
+        __m256 Length2 = _mm256_fmadd_ps(Out[3], Out[3], _mm256_fmadd_ps(Out[4], Out[4], _mm256_mul_ps(Out[5], Out[5])));
+        __m256 InvLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_max_ps(Length2, _mm256_set1_ps(1e-30f))));
+
+        float Lanes[6][8];
+        for (int a = 0 ; a < 6 ; a++) _mm256_storeu_ps(Lanes[a], a < 3 ? Out[a] : _mm256_mul_ps(Out[a], InvLength));
+        StoreSkinnedVertices(Lanes, 8, pOut + 6 * (size_t)i);
+    }
+
+    SkinVerticesSSE(pPalette, V, i, End, pOut);
+}
+
+static bool CpuHasAVX2() {
+#ifdef _MSC_VER
+    int Info[4];
+    __cpuid(Info, 0);
+    if (Info[0] < 7) return false;
+    __cpuid(Info, 1);
+    bool HasFMA = (Info[2] & (1 << 12)) != 0;
+    bool HasOSXSAVE = (Info[2] & (1 << 27)) != 0;
+    if (!HasFMA || !HasOSXSAVE || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(Info, 7, 0);
+    return (Info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Dispatch
+
+struct KernelTable {
+    void (*ComposeLocals)(const NodeTRS&, unsigned int, unsigned int, glm::mat4*);
+    void (*ConcatenateGlobals)(const int*, const glm::mat4*, unsigned int, glm::mat4*);
+    void (*ComputePalette)(const glm::mat4&, const glm::mat4*, const int*, const glm::mat4*, unsigned int, AffineMatrix*);
+    void (*SkinVertices)(const AffineMatrix*, const SkinningVertices&, unsigned int, unsigned int, float*);
+    const char* Name;
+};
+
+static KernelTable SelectKernels() {
+#ifdef BONE_KERNELS_X86
+    if (CpuHasAVX2()) {
+        return { ComposeLocalsAVX2, ConcatenateGlobalsAVX2, ComputePaletteAVX2, SkinVerticesAVX2, "AVX2" };
+    }
+    return { ComposeLocalsSSE, ConcatenateGlobalsSSE, ComputePaletteSSE, SkinVerticesSSE, "SSE2" };
+#else
+    return { ComposeLocalsScalar, ConcatenateGlobalsScalar, ComputePaletteScalar, SkinVerticesScalar, "Scalar" };
+#endif
+}
+
+static const KernelTable& GetKernels() {
+    static const KernelTable Table = SelectKernels();
+    return Table;
+}
+
+namespace BoneKernels {
+    void ComposeLocals(const NodeTRS& Locals, unsigned int Count, glm::mat4* pOut) {
+        GetKernels().ComposeLocals(Locals, 0, Count, pOut);
+    }
+
+    void ConcatenateGlobals(const int* pParents, const glm::mat4* pLocals, unsigned int Count, glm::mat4* pGlobals) {
+        GetKernels().ConcatenateGlobals(pParents, pLocals, Count, pGlobals);
+    }
+
+    void ComputePalette(const glm::mat4& GlobalInverse, const glm::mat4* pGlobals, const int* pBoneNodes,
+                        const glm::mat4* pOffsets, unsigned int NumBones, AffineMatrix* pPalette) {
+        GetKernels().ComputePalette(GlobalInverse, pGlobals, pBoneNodes, pOffsets, NumBones, pPalette);
+    }
+
+    // Scalar on every target, quat_cast branches per matrix and this runs once per bone, not per node
+    void ComputeDualQuaternions(const AffineMatrix* pPalette, unsigned int NumBones, glm::mat2x4* pDualQuats) {
+        for (unsigned int b = 0 ; b < NumBones ; b++) {
+            glm::mat4 m = FromAffine(pPalette[b]);
+            glm::vec3 X(m[0]), Y(m[1]), Z(m[2]);
+            float Lx = glm::length(X), Ly = glm::length(Y), Lz = glm::length(Z);
+            if (Lx < 1e-8f || Ly < 1e-8f || Lz < 1e-8f) {
+                pDualQuats[b] = glm::mat2x4(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec4(0.0f));
+                continue;
+            }
+
+            glm::quat q = glm::normalize(glm::quat_cast(glm::mat3(X / Lx, Y / Ly, Z / Lz)));
+            glm::vec3 r(q.x, q.y, q.z), t(m[3]);
+            // dual = 0.5 * (t, 0) * q
+            glm::vec3 Dual = 0.5f * (q.w * t + glm::cross(t, r));
+            pDualQuats[b] = glm::mat2x4(glm::vec4(r, q.w), glm::vec4(Dual, -0.5f * glm::dot(t, r)));
+        }
+    }
+
+    void SkinVertices(const AffineMatrix* pPalette, const SkinningVertices& Vertices, unsigned int Begin,
+                      unsigned int End, float* pOut) {
+        GetKernels().SkinVertices(pPalette, Vertices, Begin, End, pOut);
+    }
+
+    const char* GetInstructionSet() {
+        return GetKernels().Name;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#define BONE_BATCH_WIDTH 8
+#define SKIN_INFLUENCES 8
+
+// Bone palette entry. Bone transforms are affine, so only the top three rows of the 4x4 matrix are
+// kept, row r in column [r]: 48 bytes instead of 64. Laid out as a std140 mat3x4, which the shaders
+// apply as vec4(p, 1) * M.
+typedef glm::mat3x4 AffineMatrix;
+
+inline AffineMatrix ToAffine(const glm::mat4& m) { return AffineMatrix(glm::transpose(m)); }
+inline glm::mat4 FromAffine(const AffineMatrix& a) { return glm::transpose(glm::mat4(a)); }
+
+// Local transforms of a set of nodes, structure-of-arrays. The arrays are padded to a multiple
+// of BONE_BATCH_WIDTH so the kernels can always work on full batches.
+struct NodeTRS {
+    std::vector<float> Tx, Ty, Tz;
+    std::vector<float> Qx, Qy, Qz, Qw;
+    std::vector<float> Sx, Sy, Sz;
+
+    void Resize(unsigned int Count);
+    unsigned int Size() const { return (unsigned int)Tx.size(); }
+
+    void Set(unsigned int i, const glm::vec3& T, const glm::quat& R, const glm::vec3& S) {
+        Tx[i] = T.x; Ty[i] = T.y; Tz[i] = T.z;
+        Qx[i] = R.x; Qy[i] = R.y; Qz[i] = R.z; Qw[i] = R.w;
+        Sx[i] = S.x; Sy[i] = S.y; Sz[i] = S.z;
+    }
+};
+
+// Bind-pose vertices for CPU skinning, structure-of-arrays so a batch of vertices loads each
+// attribute with one instruction. Only the first NumInfluences bone ID and weight arrays are used.
+struct SkinningVertices {
+    std::vector<float> Px, Py, Pz;
+    std::vector<float> Nx, Ny, Nz;
+    std::vector<int> BoneIDs[SKIN_INFLUENCES];
+    std::vector<float> Weights[SKIN_INFLUENCES];
+    unsigned int NumInfluences = 0;
+
+    void Resize(unsigned int Count, unsigned int Influences = SKIN_INFLUENCES);
+    unsigned int Size() const { return (unsigned int)Px.size(); }
+};
+
+// Batched kernels turning local TRS into a bone palette. The implementation is picked once at
+// runtime from the CPU features (AVX2, SSE2, or plain scalar code).
+namespace BoneKernels {
+    // pOut[i] = translate(T) * mat4(R) * scale(S) for i < Count
+    void ComposeLocals(const NodeTRS& Locals, unsigned int Count, glm::mat4* pOut);
+    // pGlobals[i] = pGlobals[Parent[i]] * pLocals[i], parents must precede their children
+    void ConcatenateGlobals(const int* pParents, const glm::mat4* pLocals, unsigned int Count, glm::mat4* pGlobals);
+    // pPalette[b] = ToAffine(GlobalInverse * pGlobals[pBoneNodes[b]] * pOffsets[b]), skipping bones without a node
+    void ComputePalette(const glm::mat4& GlobalInverse, const glm::mat4* pGlobals, const int* pBoneNodes,
+                        const glm::mat4* pOffsets, unsigned int NumBones, AffineMatrix* pPalette);
+    // Rigid part of each palette matrix as a unit dual quaternion, column 0 the rotation and column 1
+    // the dual part, both (x, y, z, w). Scale is dropped, degenerate matrices give the identity.
+    void ComputeDualQuaternions(const AffineMatrix* pPalette, unsigned int NumBones, glm::mat2x4* pDualQuats);
+
+    // Linear blend skinning of vertices [Begin, End). Position then normal are written for each vertex,
+    // 6 floats per vertex from pOut[6 * Begin]. Every bone ID must index pPalette.
+    void SkinVertices(const AffineMatrix* pPalette, const SkinningVertices& Vertices, unsigned int Begin,
+                      unsigned int End, float* pOut);
+
+    const char* GetInstructionSet();
+}
@@ -0,0 +1,250 @@
+#include "compressedClip.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#define QUANTIZE_MAX 65535.0f
+#define SMALLEST_THREE_MAX 32767.0f
+#define SMALLEST_THREE_RANGE 0.70710678f // 1 / sqrt(2), the largest value a non-largest component can take
+
+// Greedy key reduction: starting from each kept key, extend the segment as far as linear
+// interpolation to its end key keeps every frame in between within Tolerance.
+template<typename ErrorFn>
+static void ReduceKeys(unsigned int NumFrames, float Tolerance, ErrorFn Error, std::vector<uint16_t>& Kept) {
+    Kept.clear();
+    Kept.push_back(0);
+
+    bool Constant = true;
+    for (unsigned int f = 1 ; f < NumFrames && Constant ; f++) {
+        Constant = Error(0, 0, f) <= Tolerance;
+    }
+    if (Constant) return;
+
+    unsigned int Start = 0;
+    while (Start < NumFrames - 1) {
+        unsigned int End = Start + 1;
+        while (End + 1 < NumFrames) {
+            bool Fits = true;
+            for (unsigned int f = Start + 1 ; f <= End && Fits ; f++) {
+                Fits = Error(Start, End + 1, f) <= Tolerance;
+            }
+            if (!Fits) break;
+            End++;
+        }
+        Kept.push_back((uint16_t)End);
+        Start = End;
+    }
+}
+
+// Rotation angle between two unit quaternions. Uses the chord length rather than acos(dot), which
+// loses most of its precision for the small angles the error bounds are about.
+static float QuatAngle(const glm::quat& a, glm::quat b) {
+    if (glm::dot(a, b) < 0.0f) b = -b;
+    glm::vec4 Chord(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w);
+    return 4.0f * std::asin(std::min(1.0f, 0.5f * glm::length(Chord)));
+}
+
+static glm::quat Nlerp(const glm::quat& a, glm::quat b, float Factor) {
+    if (glm::dot(a, b) < 0.0f) b = -b;
+    glm::quat q;
+    q.x = a.x + (b.x - a.x) * Factor;
+    q.y = a.y + (b.y - a.y) * Factor;
+    q.z = a.z + (b.z - a.z) * Factor;
+    q.w = a.w + (b.w - a.w) * Factor;
+    return glm::normalize(q);
+}
+
+static void PackSmallestThree(const glm::quat& q, uint16_t* pOut) {
+    float c[4] = { q.x, q.y, q.z, q.w };
+    int Largest = 0;
+    for (int i = 1 ; i < 4 ; i++) {
+        if (std::fabs(c[i]) > std::fabs(c[Largest])) Largest = i;
+    }
+    float Sign = c[Largest] < 0.0f ? -1.0f : 1.0f;
+
+    uint16_t Packed[3];
+    for (int i = 0, j = 0 ; i < 4 ; i++) {
+        if (i == Largest) continue;
+        float v = std::clamp(Sign * c[i] / SMALLEST_THREE_RANGE, -1.0f, 1.0f);
+        Packed[j++] = (uint16_t)std::lround((v * 0.5f + 0.5f) * SMALLEST_THREE_MAX);
+    }
+    // The index of the dropped component goes in the spare top bits of the first two values
+    pOut[0] = (uint16_t)(Packed[0] | ((Largest >> 1) << 15));
+    pOut[1] = (uint16_t)(Packed[1] | ((Largest & 1) << 15));
+    pOut[2] = Packed[2];
+}
+
+glm::quat CompressedClip::RotationKeys::Decode(uint32_t Key) const {
+    const uint16_t* p = &Values[(size_t)Key * 3];
+    int Largest = ((p[0] >> 15) << 1) | (p[1] >> 15);
+    float Small[3] = { (float)(p[0] & 0x7FFF), (float)(p[1] & 0x7FFF), (float)p[2] };
+
+    float c[4];
+    float SumSq = 0.0f;
+    for (int i = 0, j = 0 ; i < 4 ; i++) {
+        if (i == Largest) continue;
+        c[i] = (Small[j++] / SMALLEST_THREE_MAX * 2.0f - 1.0f) * SMALLEST_THREE_RANGE;
+        SumSq += c[i] * c[i];
+    }
+    c[Largest] = std::sqrt(std::max(0.0f, 1.0f - SumSq));
+    return glm::normalize(glm::quat(c[3], c[0], c[1], c[2]));
+}
+
+glm::vec3 CompressedClip::VectorKeys::Decode(const VectorTrack& Track, uint32_t Key) const {
+    const uint16_t* p = &Values[(size_t)Key * 3];
+    return Track.Min + Track.Step * glm::vec3(p[0], p[1], p[2]);
+}
+
+size_t CompressedClip::VectorKeys::MemoryBytes() const {
+    return Tracks.size() * sizeof(VectorTrack) + (Frames.size() + Values.size()) * sizeof(uint16_t);
+}
+
+size_t CompressedClip::RotationKeys::MemoryBytes() const {
+    return Tracks.size() * sizeof(Track) + (Frames.size() + Values.size()) * sizeof(uint16_t);
+}
+
+void CompressedClip::CompressVectors(const BakedClip& Source, bool Scales, float MaxError, VectorKeys& Out) {
+    unsigned int NumFrames = Source.NumFrames();
+    auto Get = [&](unsigned int Frame, unsigned int Track) {
+        return Scales ? Source.GetScale(Frame, Track) : Source.GetTranslation(Frame, Track);
+    };
+
+    Out.Tracks.resize(Source.NumTracks());
+    std::vector<uint16_t> Kept;
+
+    for (unsigned int t = 0 ; t < Source.NumTracks() ; t++) {
+        glm::vec3 Min = Get(0, t);
+        glm::vec3 Max = Min;
+        for (unsigned int f = 1 ; f < NumFrames ; f++) {
+            Min = glm::min(Min, Get(f, t));
+            Max = glm::max(Max, Get(f, t));
+        }
+        glm::vec3 Step = (Max - Min) / QUANTIZE_MAX;
+
+        // Leave room in the error budget for half a quantization step
+        float QuantizationError = 0.5f * std::max({Step.x, Step.y, Step.z});
+        float Tolerance = std::max(MaxError - QuantizationError, 0.0f);
+
+        ReduceKeys(NumFrames, Tolerance, [&](unsigned int First, unsigned int Last, unsigned int f) {
+            glm::vec3 Fitted = Get(First, t);
+            if (Last != First) {
+                float Factor = (float)(f - First) / (float)(Last - First);
+                Fitted = glm::mix(Fitted, Get(Last, t), Factor);
+            }
+            glm::vec3 Delta = glm::abs(Fitted - Get(f, t));
+            return std::max({Delta.x, Delta.y, Delta.z});
+        }, Kept);
+
+        VectorTrack& Dst = Out.Tracks[t];
+        Dst.FirstKey = (uint32_t)Out.Frames.size();
+        Dst.NumKeys = (uint32_t)Kept.size();
+        Dst.Min = Min;
+        Dst.Step = Step;
+
+        for (uint16_t f : Kept) {
+            glm::vec3 v = Get(f, t);
+            Out.Frames.push_back(f);
+            for (int c = 0 ; c < 3 ; c++) {
+                float q = Step[c] > 0.0f ? (v[c] - Min[c]) / Step[c] : 0.0f;
+                Out.Values.push_back((uint16_t)std::lround(std::clamp(q, 0.0f, QUANTIZE_MAX)));
+            }
+        }
+    }
+}
+
+void CompressedClip::CompressRotations(const BakedClip& Source, float MaxError, RotationKeys& Out) {
+    unsigned int NumFrames = Source.NumFrames();
+    // Smallest-three at 15 bits stays within about 1e-4 radians
+    float Tolerance = std::max(MaxError - 2e-4f, 0.0f);
+
+    Out.Tracks.resize(Source.NumTracks());
+    std::vector<uint16_t> Kept;
+
+    for (unsigned int t = 0 ; t < Source.NumTracks() ; t++) {
+        ReduceKeys(NumFrames, Tolerance, [&](unsigned int First, unsigned int Last, unsigned int f) {
+            glm::quat Fitted = Source.GetRotation(First, t);
+            if (Last != First) {
+                float Factor = (float)(f - First) / (float)(Last - First);
+                Fitted = Nlerp(Fitted, Source.GetRotation(Last, t), Factor);
+            }
+            return QuatAngle(Fitted, Source.GetRotation(f, t));
+        }, Kept);
+
+        Track& Dst = Out.Tracks[t];
+        Dst.FirstKey = (uint32_t)Out.Frames.size();
+        Dst.NumKeys = (uint32_t)Kept.size();
+
+        for (uint16_t f : Kept) {
+            Out.Frames.push_back(f);
+            Out.Values.resize(Out.Values.size() + 3);
+            PackSmallestThree(Source.GetRotation(f, t), &Out.Values[Out.Values.size() - 3]);
+        }
+    }
+}
+
+bool CompressedClip::Compress(const BakedClip& Source, float MaxPositionError, float MaxRotationError,
+                              float MaxScaleError) {
+    if (Source.NumFrames() > COMPRESSED_CLIP_MAX_FRAMES) return false;
+
+    m_NumTracks = Source.NumTracks();
+    m_DurationTicks = Source.DurationTicks();
+    m_TicksPerSecond = Source.TicksPerSecond();
+    m_NumFrames = Source.NumFrames();
+    m_FramesPerTick = Source.FramesPerTick();
+
+    CompressVectors(Source, false, MaxPositionError, m_Translations);
+    CompressRotations(Source, MaxRotationError, m_Rotations);
+    CompressVectors(Source, true, MaxScaleError, m_Scales);
+    return true;
+}
+
+// Returns the key at or before Frame and the interpolation factor towards the key after it
+uint32_t CompressedClip::FindKey(const std::vector<uint16_t>& Frames, const Track& KeyTrack, float Frame, float& Factor) {
+    Factor = 0.0f;
+    if (KeyTrack.NumKeys == 1) return KeyTrack.FirstKey;
+
+    const uint16_t* pBegin = &Frames[KeyTrack.FirstKey];
+    const uint16_t* pEnd = pBegin + KeyTrack.NumKeys;
+    const uint16_t* pNext = std::upper_bound(pBegin + 1, pEnd, Frame,
+                                             [](float f, uint16_t KeyFrame) { return f < (float)KeyFrame; });
+    if (pNext == pEnd) return KeyTrack.FirstKey + KeyTrack.NumKeys - 1;
+
+    const uint16_t* pPrev = pNext - 1;
+    Factor = std::clamp((Frame - (float)*pPrev) / (float)(*pNext - *pPrev), 0.0f, 1.0f);
+    return (uint32_t)(pPrev - &Frames[0]);
+}
+
+void CompressedClip::SampleTracks(float AnimationTimeTicks, LocalPose& Pose, unsigned int FirstTrack,
+                                  unsigned int EndTrack) const {
+    Pose.Resize(m_NumTracks);
+    EndTrack = std::min(EndTrack, m_NumTracks);
+    float Frame = TimeToFrame(AnimationTimeTicks, m_FramesPerTick, m_NumFrames);
+
+    for (unsigned int t = FirstTrack ; t < EndTrack ; t++) {
+        float Factor;
+
+        const VectorTrack& T = m_Translations.Tracks[t];
+        uint32_t Key = FindKey(m_Translations.Frames, T, Frame, Factor);
+        Pose.Translations[t] = m_Translations.Decode(T, Key);
+        if (Factor > 0.0f) {
+            Pose.Translations[t] = glm::mix(Pose.Translations[t], m_Translations.Decode(T, Key + 1), Factor);
+        }
+
+        Key = FindKey(m_Rotations.Frames, m_Rotations.Tracks[t], Frame, Factor);
+        Pose.Rotations[t] = m_Rotations.Decode(Key);
+        if (Factor > 0.0f) {
+            Pose.Rotations[t] = Nlerp(Pose.Rotations[t], m_Rotations.Decode(Key + 1), Factor);
+        }
+
+        const VectorTrack& S = m_Scales.Tracks[t];
+        Key = FindKey(m_Scales.Frames, S, Frame, Factor);
+        Pose.Scales[t] = m_Scales.Decode(S, Key);
+        if (Factor > 0.0f) {
+            Pose.Scales[t] = glm::mix(Pose.Scales[t], m_Scales.Decode(S, Key + 1), Factor);
+        }
+    }
+}
+
+size_t CompressedClip::MemoryBytes() const {
+    return m_Translations.MemoryBytes() + m_Rotations.MemoryBytes() + m_Scales.MemoryBytes();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "animationClip.h"
+
+// Key frame indices are 16 bits, longer clips (over 36 minutes at 30 Hz) stay uncompressed
+#define COMPRESSED_CLIP_MAX_FRAMES 65536
+
+// A baked clip compressed within user-set error bounds. Tracks that never move beyond the bound
+// collapse to a single key, the remaining tracks keep only the keys that linear interpolation
+// cannot reproduce within the bound. Translations and scales are quantized to 16 bits per
+// component over each track's range, rotations are packed smallest-three into 48 bits.
+class CompressedClip : public AnimationClip {
+public:
+    // False, leaving this clip untouched, when Source has more than COMPRESSED_CLIP_MAX_FRAMES frames
+    bool Compress(const BakedClip& Source, float MaxPositionError, float MaxRotationError,
+                  float MaxScaleError = 0.001f);
+    void SampleTracks(float AnimationTimeTicks, LocalPose& Pose, unsigned int FirstTrack,
+                      unsigned int EndTrack) const override;
+    size_t MemoryBytes() const override;
+
+private:
+    struct Track {
+        uint32_t FirstKey = 0;
+        uint32_t NumKeys = 0; // 1 for a constant track
+    };
+
+    struct VectorTrack : Track {
+        glm::vec3 Min{};
+        glm::vec3 Step{}; // range / 65535, per component
+    };
+
+    struct VectorKeys {
+        std::vector<VectorTrack> Tracks;
+        std::vector<uint16_t> Frames; // frame index of every key
+        std::vector<uint16_t> Values; // 3 per key
+
+        glm::vec3 Decode(const VectorTrack& Track, uint32_t Key) const;
+        size_t MemoryBytes() const;
+    };
+
+    struct RotationKeys {
+        std::vector<Track> Tracks;
+        std::vector<uint16_t> Frames;
+        std::vector<uint16_t> Values; // 3 per key, smallest-three packed
+
+        glm::quat Decode(uint32_t Key) const;
+        size_t MemoryBytes() const;
+    };
+
+    static void CompressVectors(const BakedClip& Source, bool Scales, float MaxError, VectorKeys& Out);
+    static void CompressRotations(const BakedClip& Source, float MaxError, RotationKeys& Out);
+    static uint32_t FindKey(const std::vector<uint16_t>& Frames, const Track& KeyTrack, float Frame, float& Factor);
+
+    unsigned int m_NumFrames = 0;
+    float m_FramesPerTick = 0.0f;
+
+    VectorKeys m_Translations;
+    RotationKeys m_Rotations;
+    VectorKeys m_Scales;
+};
@@ -0,0 +1,92 @@
+#include "keyframes.h"
+
+static void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim,
+                                     unsigned int& Cursor) {
+
+    const aiVectorKey& Last = pNodeAnim->mPositionKeys[pNodeAnim->mNumPositionKeys - 1];
+    if (pNodeAnim->mNumPositionKeys == 1 || AnimationTimeTicks >= (float)Last.mTime) {
+        Out = Last.mValue;
+        return;
+    }
+
+    unsigned int PositionIndex = FindKey(AnimationTimeTicks, pNodeAnim->mPositionKeys, pNodeAnim->mNumPositionKeys,
+                                         Cursor);
+    unsigned int NextPositionIndex = PositionIndex + 1;
+    assert(NextPositionIndex < pNodeAnim->mNumPositionKeys);
+    float t1 = (float)pNodeAnim->mPositionKeys[PositionIndex].mTime;
+    if (t1 > AnimationTimeTicks) {
+        Out = pNodeAnim->mPositionKeys[PositionIndex].mValue;
+    } else {
+        float t2 = (float)pNodeAnim->mPositionKeys[NextPositionIndex].mTime;
+        float DeltaTime = t2 - t1;
+        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
+        assert(Factor >= 0.0f && Factor <= 1.0f);
+        const aiVector3D& Start = pNodeAnim->mPositionKeys[PositionIndex].mValue;
+        const aiVector3D& End = pNodeAnim->mPositionKeys[NextPositionIndex].mValue;
+        aiVector3D Delta = End - Start;
+        Out = Start + Factor * Delta;
+    }
+}
+
+static void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim,
+                                     unsigned int& Cursor) {
+
+    const aiQuatKey& Last = pNodeAnim->mRotationKeys[pNodeAnim->mNumRotationKeys - 1];
+    if (pNodeAnim->mNumRotationKeys == 1 || AnimationTimeTicks >= (float)Last.mTime) {
+        Out = Last.mValue;
+        return;
+    }
+
+    unsigned int RotationIndex = FindKey(AnimationTimeTicks, pNodeAnim->mRotationKeys, pNodeAnim->mNumRotationKeys,
+                                         Cursor);
+    unsigned int NextRotationIndex = RotationIndex + 1;
+    assert(NextRotationIndex < pNodeAnim->mNumRotationKeys);
+    float t1 = (float)pNodeAnim->mRotationKeys[RotationIndex].mTime;
+    if (t1 > AnimationTimeTicks) {
+        Out = pNodeAnim->mRotationKeys[RotationIndex].mValue;
+    } else {
+        float t2 = (float)pNodeAnim->mRotationKeys[NextRotationIndex].mTime;
+        float DeltaTime = t2 - t1;
+        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
+        assert(Factor >= 0.0f && Factor <= 1.0f);
+        const aiQuaternion& StartRotationQ = pNodeAnim->mRotationKeys[RotationIndex].mValue;
+        const aiQuaternion& EndRotationQ   = pNodeAnim->mRotationKeys[NextRotationIndex].mValue;
+        aiQuaternion::Interpolate(Out, StartRotationQ, EndRotationQ, Factor);
+    }
+    Out.Normalize();
+}
+
+static void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim,
+                                    unsigned int& Cursor) {
+
+    const aiVectorKey& Last = pNodeAnim->mScalingKeys[pNodeAnim->mNumScalingKeys - 1];
+    if (pNodeAnim->mNumScalingKeys == 1 || AnimationTimeTicks >= (float)Last.mTime) {
+        Out = Last.mValue;
+        return;
+    }
+
+    unsigned int ScalingIndex = FindKey(AnimationTimeTicks, pNodeAnim->mScalingKeys, pNodeAnim->mNumScalingKeys,
+                                        Cursor);
+    unsigned int NextScalingIndex = ScalingIndex + 1;
+    assert(NextScalingIndex < pNodeAnim->mNumScalingKeys);
+    auto t1 = (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime;
+    if (t1 > AnimationTimeTicks) {
+        Out = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
+    } else {
+        auto t2 = (float)pNodeAnim->mScalingKeys[NextScalingIndex].mTime;
+        float DeltaTime = t2 - t1;
+        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
+        assert(Factor >= 0.0f && Factor <= 1.0f);
+        const aiVector3D& Start = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
+        const aiVector3D& End   = pNodeAnim->mScalingKeys[NextScalingIndex].mValue;
+        aiVector3D Delta = End - Start;
+        Out = Start + Factor * Delta;
+    }
+}
+
+void CalcLocalTransform(LocalTransform& Transform, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim,
+                        KeyCursor& Cursor) {
+    CalcInterpolatedScaling(Transform.Scaling, AnimationTimeTicks, pNodeAnim, Cursor.Scaling);
+    CalcInterpolatedRotation(Transform.Rotation, AnimationTimeTicks, pNodeAnim, Cursor.Rotation);
+    CalcInterpolatedPosition(Transform.Translation, AnimationTimeTicks, pNodeAnim, Cursor.Position);
+}
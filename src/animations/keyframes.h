@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <assimp/anim.h>
+
+// Sampling of imported aiNodeAnim channels, which are only read while clips are baked at load
+
+struct LocalTransform {
+    aiVector3D Scaling;
+    aiQuaternion Rotation;
+    aiVector3D Translation;
+};
+
+// Last key index found on each track of a channel. Forward sweeps usually land on the
+// same or the next key, anything else falls back to a binary search.
+struct KeyCursor {
+    unsigned int Position = 0;
+    unsigned int Rotation = 0;
+    unsigned int Scaling = 0;
+};
+
+// Returns the index i of the key pair [i, i + 1] that brackets AnimationTimeTicks, or 0 when no
+// pair does. The cursor is checked first, then its successor, before falling back to a binary search.
+template<typename KeyType>
+unsigned int FindKey(float AnimationTimeTicks, const KeyType* pKeys, unsigned int NumKeys, unsigned int& Cursor) {
+
+    assert(NumKeys > 0);
+    auto Brackets = [&](unsigned int i) {
+        return i + 1 < NumKeys &&
+               (i == 0 || AnimationTimeTicks >= (float)pKeys[i].mTime) &&
+               AnimationTimeTicks < (float)pKeys[i + 1].mTime;
+    };
+
+    if (Brackets(Cursor)) return Cursor;
+    if (Brackets(Cursor + 1)) return ++Cursor;
+
+    const KeyType* pNext = std::upper_bound(pKeys + 1, pKeys + NumKeys, AnimationTimeTicks,
+                                            [](float t, const KeyType& Key) { return t < (float)Key.mTime; });
+    Cursor = (pNext == pKeys + NumKeys) ? 0 : (unsigned int)(pNext - pKeys) - 1;
+    return Cursor;
+}
+
+// The scan from key 0 that FindKey replaced, same result. Only kept as the benchmark's baseline.
+template<typename KeyType>
+unsigned int FindKeyLinear(float AnimationTimeTicks, const KeyType* pKeys, unsigned int NumKeys) {
+    for (unsigned int i = 0 ; i + 1 < NumKeys ; i++) {
+        if (AnimationTimeTicks < (float)pKeys[i + 1].mTime) return i;
+    }
+    return 0;
+}
+
+// Interpolates the channel's scaling, rotation and translation keys at AnimationTimeTicks, holding
+// the last key past the end
+void CalcLocalTransform(LocalTransform& Transform, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim,
+                        KeyCursor& Cursor);
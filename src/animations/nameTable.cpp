@@ -0,0 +1,61 @@
+#include "nameTable.h"
+#include <cstring>
+
+// FNV-1a
+uint32_t NameTable::Hash(const char* pName, size_t Length) {
+    uint32_t Hash = 2166136261u;
+    for (size_t i = 0 ; i < Length ; i++) {
+        Hash = (Hash ^ (unsigned char)pName[i]) * 16777619u;
+    }
+    return Hash;
+}
+
+// Slot holding the name, or the empty slot where it would go
+int NameTable::FindSlot(const char* pName, size_t Length, uint32_t Hash) const {
+    uint32_t Mask = (uint32_t)m_Slots.size() - 1;
+    for (uint32_t Slot = Hash & Mask ; ; Slot = (Slot + 1) & Mask) {
+        int ID = m_Slots[Slot];
+        if (ID < 0) return (int)Slot;
+        const std::string& Name = m_Names[ID];
+        if (m_Hashes[ID] == Hash && Name.size() == Length && memcmp(Name.data(), pName, Length) == 0) {
+            return (int)Slot;
+        }
+    }
+}
+
+unsigned int NameTable::Intern(const char* pName, size_t Length) {
+    // At most half full, so probes stay short and always end on an empty slot
+    if ((m_Names.size() + 1) * 2 > m_Slots.size()) Grow();
+
+    uint32_t NameHash = Hash(pName, Length);
+    int Slot = FindSlot(pName, Length, NameHash);
+    if (m_Slots[Slot] >= 0) return (unsigned int)m_Slots[Slot];
+
+    m_Slots[Slot] = (int)m_Names.size();
+    m_Names.emplace_back(pName, Length);
+    m_Hashes.push_back(NameHash);
+    return (unsigned int)m_Names.size() - 1;
+}
+
+int NameTable::Find(const char* pName, size_t Length) const {
+    if (m_Slots.empty()) return -1;
+    return m_Slots[FindSlot(pName, Length, Hash(pName, Length))];
+}
+
+void NameTable::Clear() {
+    m_Names.clear();
+    m_Hashes.clear();
+    m_Slots.clear();
+}
+
+void NameTable::Grow() {
+    size_t NumSlots = m_Slots.empty() ? NAME_TABLE_MIN_SLOTS : m_Slots.size() * 2;
+    m_Slots.assign(NumSlots, -1);
+
+    uint32_t Mask = (uint32_t)NumSlots - 1;
+    for (unsigned int ID = 0 ; ID < m_Names.size() ; ID++) {
+        uint32_t Slot = m_Hashes[ID] & Mask;
+        while (m_Slots[Slot] >= 0) Slot = (Slot + 1) & Mask;
+        m_Slots[Slot] = (int)ID;
+    }
+}
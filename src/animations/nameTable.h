@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define NAME_TABLE_MIN_SLOTS 256
+
+// Interns names into dense IDs 0, 1, 2, ... in first-seen order, so everything past import works
+// on integers. Lookups hash the name once and probe a flat open-addressing table: no tree walk,
+// and no allocation unless a new name is added.
+class NameTable {
+public:
+    // ID of the name, added if it is not there yet
+    unsigned int Intern(const char* pName, size_t Length);
+    unsigned int Intern(const std::string& Name) { return Intern(Name.data(), Name.size()); }
+    // -1 if the name was never interned
+    int Find(const char* pName, size_t Length) const;
+    int Find(const std::string& Name) const { return Find(Name.data(), Name.size()); }
+
+    const std::string& GetName(unsigned int ID) const { return m_Names[ID]; }
+    unsigned int Size() const { return (unsigned int)m_Names.size(); }
+    void Clear();
+
+private:
+    static uint32_t Hash(const char* pName, size_t Length);
+    int FindSlot(const char* pName, size_t Length, uint32_t Hash) const;
+    void Grow();
+
+    std::vector<std::string> m_Names;
+    std::vector<uint32_t> m_Hashes;  // per ID, growing never hashes a name again
+    std::vector<int> m_Slots;        // ID per slot, -1 when empty. Size is a power of two.
+};
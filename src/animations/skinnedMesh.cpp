@@ -1,17 +1,18 @@
 #include "skinnedMesh.h"
+#include <algorithm>
+#include <assimp/config.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "keyframes.h"
 #include "../texture.h"
 #include "../camera.h"
 #include "../shaders.h"
 
-#ifdef _WIN32
-#include <Windows.h>
-#else
-#include <sys/time.h>
-#endif
-
 using namespace std;
 
 #define POSITION_LOCATION 0
@@ -19,19 +20,8 @@ using namespace std;
 #define NORMAL_LOCATION 2
 #define BONE_ID_LOCATION 3
 #define BONE_WEIGHT_LOCATION 4
-
-long long GetCurrentTimeMillis()
-{
-#ifdef _WIN32
-    return GetTickCount64();
-#else
-    timeval t;
-    gettimeofday(&t, NULL);
-
-    long long ret = t.tv_sec * 1000 + t.tv_usec / 1000;
-    return ret;
-#endif
-}
+#define EXTRA_BONE_ID_LOCATION 5
+#define EXTRA_BONE_WEIGHT_LOCATION 6
 
 inline glm::mat4 AiToGlmMat4(const aiMatrix4x4& mat) {
     return {
@@ -69,31 +59,76 @@ void SkinnedMesh::Clear() {
         glDeleteVertexArrays(1, &m_VAO);
         m_VAO = 0;
     }
+
+    if (m_SkinnedVAO != 0) {
+        glDeleteVertexArrays(1, &m_SkinnedVAO);
+        m_SkinnedVAO = 0;
+    }
+}
+
+// Indexed by SkinningMode
+static const char* SKINNING_VERTEX_SHADERS[] = {
+    "../res/shaders/skinned_vertex.glsl",
+    "../res/shaders/skinned_vertex_dq.glsl",
+};
+
+// Defines that specialize a skinning vertex shader for the influence count of one bucket
+static string InfluenceDefines(uint Bucket) {
+    return "#define NUM_INFLUENCES " + std::to_string(INFLUENCE_BUCKET_SIZE(Bucket)) + "\n";
+}
+
+// Palettes and world matrices are read by the instanced programs as RGBA32F texels
+#define PALETTE_TEXEL_SIZE sizeof(glm::vec4)
+
+// The skinning vertex shaders are GLSL 4.10, which cannot give a block its binding in the source
+static void BindPaletteBlock(GLuint Program) {
+    GLuint Index = glGetUniformBlockIndex(Program, "BonePalette");
+    if (Index != GL_INVALID_INDEX) glUniformBlockBinding(Program, Index, PALETTE_BLOCK_BINDING);
 }
 
 bool SkinnedMesh::init() {
-    GLuint vs = gl::Shader::init_shaders(GL_VERTEX_SHADER, "../res/shaders/skinned_vertex.glsl");
+    // One program per SkinningMode and influence bucket, and its instanced twin. They only differ
+    // in the vertex shader.
     GLuint fs = gl::Shader::init_shaders(GL_FRAGMENT_SHADER, "../res/shaders/skinned_fragment.glsl");
-    m_shaderProg = gl::Shader::init_program(vs, fs);
-    GLint linkStatus;
-    glGetProgramiv(m_shaderProg, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus != GL_TRUE) {
-        GLchar infoLog[512];
-        glGetProgramInfoLog(m_shaderProg, 512, NULL, infoLog);
-        fprintf(stderr, "Program linking failed: %s\n", infoLog);
-        return false;
+    for (unsigned int i = 0 ; i < std::size(m_skinningProgs) ; i++) {
+        for (uint b = 0 ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+            for (bool Instanced : { false, true }) {
+                string Defines = InfluenceDefines(b) + (Instanced ? "#define INSTANCED\n" : "");
+                GLuint vs = gl::Shader::init_shaders(GL_VERTEX_SHADER, SKINNING_VERTEX_SHADERS[i], Defines);
+                GLuint& Program = Instanced ? m_instancedProgs[i][b] : m_skinningProgs[i][b];
+                Program = gl::Shader::init_program(vs, fs);
+                GLint linkStatus;
+                glGetProgramiv(Program, GL_LINK_STATUS, &linkStatus);
+                if (linkStatus != GL_TRUE) {
+                    GLchar infoLog[512];
+                    glGetProgramInfoLog(Program, 512, NULL, infoLog);
+                    fprintf(stderr, "Program linking failed: %s\n", infoLog);
+                    return false;
+                }
+                BindPaletteBlock(Program);
+                if (Instanced) {
+                    glUseProgram(Program);
+                    glUniform1i(glGetUniformLocation(Program, "gPalettes"), PALETTE_TEXTURE_UNIT);
+                    glUniform1i(glGetUniformLocation(Program, "gInstanceWorlds"), INSTANCE_WORLD_TEXTURE_UNIT);
+                }
+            }
+        }
     }
+    glGenTextures(1, &m_PaletteTexture);
+    glGenTextures(1, &m_InstanceWorldTexture);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_MaxTextureBufferTexels);
 
-    glUseProgram(m_shaderProg);
-    WVPLoc = gl::Shader::GetUniformLocation("gWVP", m_shaderProg);
-    samplerLoc = gl::Shader::GetUniformLocation("gSampler", m_shaderProg);
-    samplerSpecularExponentLoc = gl::Shader::GetUniformLocation("gSamplerSpecularExponent", m_shaderProg);
-    materialLoc.AmbientColor = gl::Shader::GetUniformLocation("gMaterial.AmbientColor", m_shaderProg);
-    materialLoc.DiffuseColor = gl::Shader::GetUniformLocation("gMaterial.DiffuseColor", m_shaderProg);
-    materialLoc.SpecularColor = gl::Shader::GetUniformLocation("gMaterial.SpecularColor", m_shaderProg);
-    CameraLocalPosLoc = gl::Shader::GetUniformLocation("gCameraLocalPos", m_shaderProg);
+    GLint UniformAlignment = 1;
+    GLint StorageAlignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &UniformAlignment);
+    if (GLEW_VERSION_4_3) glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &StorageAlignment);
+    GLsizeiptr Alignment = std::max({ UniformAlignment, StorageAlignment, (GLint)PALETTE_TEXEL_SIZE });
+    m_PartitionStride = ((GLsizeiptr)sizeof(AffineMatrix) * MAX_BONES + Alignment - 1) / Alignment * Alignment;
 
+    InitSkinningCachePrograms();
+    glGenQueries(std::size(m_drawTimerQueries), m_drawTimerQueries);
 
+    UseSkinningProgram();
     if (WVPLoc == 0xFFFFFFFF ||
         samplerLoc == 0xFFFFFFFF ||
         samplerSpecularExponentLoc == 0xFFFFFFFF ||
@@ -102,16 +137,90 @@ bool SkinnedMesh::init() {
         materialLoc.SpecularColor == 0xFFFFFFFF ||
         CameraLocalPosLoc == 0xFFFFFFFF){return false;}
 
-    for (unsigned int i = 0 ; i < std::size(m_boneLocation) ; i++) {
-        char Name[200];
-        memset(Name, 0, sizeof(Name));
-        SNPRINTF(Name, sizeof(Name), "gBones[%d]", i);
-        m_boneLocation[i] = gl::Shader::GetUniformLocation(Name, m_shaderProg);
+    return true;
+}
+
+void SkinnedMesh::InitSkinningCachePrograms() {
+    GLuint vs = gl::Shader::init_shaders(GL_VERTEX_SHADER, "../res/shaders/skinned_cached_vertex.glsl");
+    GLuint fs = gl::Shader::init_shaders(GL_FRAGMENT_SHADER, "../res/shaders/skinned_fragment.glsl");
+    m_cachedDrawProg = gl::Shader::init_program(vs, fs);
+
+    if (GLEW_VERSION_4_3) {
+        GLuint cs = gl::Shader::init_shaders(GL_COMPUTE_SHADER, "../res/shaders/skinning_compute.glsl");
+        m_computeProg = gl::Shader::init_compute_program(cs);
+        m_computeBaseVertexLocation = gl::Shader::GetUniformLocation("gBaseVertex", m_computeProg);
+        m_computeNumVerticesLocation = gl::Shader::GetUniformLocation("gNumVertices", m_computeProg);
+        m_computeDualQuaternionLocation = gl::Shader::GetUniformLocation("gDualQuaternion", m_computeProg);
+        m_computeNumInfluencesLocation = gl::Shader::GetUniformLocation("gNumInfluences", m_computeProg);
+        return;
+    }
+
+    // The skinning vertex shaders double as the transform feedback stage, only their Skinned* outputs are kept
+    const char* Varyings[] = { "SkinnedPosition", "SkinnedNormal" };
+    for (unsigned int i = 0 ; i < std::size(m_feedbackProgs) ; i++) {
+        for (uint b = 0 ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+            GLuint feedbackVs = gl::Shader::init_shaders(GL_VERTEX_SHADER, SKINNING_VERTEX_SHADERS[i], InfluenceDefines(b));
+            m_feedbackProgs[i][b] = gl::Shader::init_feedback_program(feedbackVs, Varyings, (int)std::size(Varyings));
+            BindPaletteBlock(m_feedbackProgs[i][b]);
+        }
     }
+}
+
+void SkinnedMesh::UseSkinningProgram() {
+    // Uncached draws switch to the variant of each bucket, the largest one can skin any vertex
+    UseDrawProgram(m_SkinningCache ? m_cachedDrawProg : m_skinningProgs[(int)m_SkinningMode][NUM_INFLUENCE_BUCKETS - 1]);
+}
+
+void SkinnedMesh::UseDrawProgram(GLuint Program) {
+    m_shaderProg = Program;
+    glUseProgram(m_shaderProg);
+    WVPLoc = gl::Shader::GetUniformLocation("gWVP", m_shaderProg);
+    samplerLoc = gl::Shader::GetUniformLocation("gSampler", m_shaderProg);
+    samplerSpecularExponentLoc = gl::Shader::GetUniformLocation("gSamplerSpecularExponent", m_shaderProg);
+    materialLoc.AmbientColor = gl::Shader::GetUniformLocation("gMaterial.AmbientColor", m_shaderProg);
+    materialLoc.DiffuseColor = gl::Shader::GetUniformLocation("gMaterial.DiffuseColor", m_shaderProg);
+    materialLoc.SpecularColor = gl::Shader::GetUniformLocation("gMaterial.SpecularColor", m_shaderProg);
+    CameraLocalPosLoc = gl::Shader::GetUniformLocation("gCameraLocalPos", m_shaderProg);
+    PaletteBaseLoc = glGetUniformLocation(m_shaderProg, "gPaletteBase");
+    PaletteStrideLoc = glGetUniformLocation(m_shaderProg, "gPaletteStride");
+    WorldBaseLoc = glGetUniformLocation(m_shaderProg, "gWorldBase");
     glUniform1i(samplerLoc, 0);
     glUniform1i(samplerSpecularExponentLoc, 8);
+}
 
-    return true;
+void SkinnedMesh::SetSkinningMode(SkinningMode Mode) {
+    if (Mode == m_SkinningMode) return;
+    m_SkinningMode = Mode;
+
+    // Instances held by a throttled LOD would otherwise draw a stale or empty palette
+    if (Mode == SkinningMode::DualQuaternion) {
+        for (AnimationInstance& Instance : m_Instances) {
+            Instance.DualQuats.resize(Instance.BoneTransforms.size());
+            BoneKernels::ComputeDualQuaternions(Instance.BoneTransforms.data(), (uint)Instance.BoneTransforms.size(),
+                                                Instance.DualQuats.data());
+        }
+    }
+
+    if (m_skinningProgs[0][0] != 0) UseSkinningProgram();
+}
+
+void SkinnedMesh::SetSkinningCache(bool Enabled, gl::JobSystem* pCpuJobs) {
+    m_pCpuSkinningJobs = Enabled ? pCpuJobs : nullptr;
+    if (Enabled == m_SkinningCache) return;
+    m_SkinningCache = Enabled;
+    if (m_skinningProgs[0][0] != 0) UseSkinningProgram();
+}
+
+void SkinnedMesh::SetClipCompression(float MaxPositionError, float MaxRotationError) {
+    m_MaxPositionError = MaxPositionError;
+    m_MaxRotationError = MaxRotationError;
+}
+
+void SkinnedMesh::SetPoseCache(float SampleRate, size_t MaxBytes) {
+    if (SampleRate == m_PoseCacheRate && MaxBytes == m_PoseCacheBudget) return;
+    m_PoseCacheRate = SampleRate;
+    m_PoseCacheBudget = MaxBytes;
+    BuildPoseCache();
 }
 
 bool SkinnedMesh::LoadMesh(const string& Filename) {
@@ -123,17 +232,23 @@ bool SkinnedMesh::LoadMesh(const string& Filename) {
     glGenBuffers(std::size(m_Buffers), m_Buffers);
 
     bool Ret = false;
+    // aiProcess_LimitBoneWeights keeps 4 influences by default
+    Importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, MAX_NUM_BONES_PER_VERTEX);
     pScene = Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
     glm::mat4 fixZUp = glm::rotate(glm::mat4(1.0f), -glm::half_pi<float>(), glm::vec3(1, 0, 0));
 
     if (pScene) {
         m_GlobalInverseTransform = glm::inverse(fixZUp * AiToGlmMat4(pScene->mRootNode->mTransformation));
         Ret = InitFromScene(pScene, Filename);
+        InitSkeleton(pScene);
+
+        // Everything needed at runtime has been copied out of the scene by now
+        Importer.FreeScene();
+        pScene = NULL;
     } else printf("Error parsing '%s': '%s'\n", Filename.c_str(), Importer.GetErrorString());
 
     glBindVertexArray(0);
-    m_startTime = GetCurrentTimeMillis();
-    m_currentTime = m_startTime;
+    m_Clock.Reset();
     return Ret;
 }
 
@@ -175,6 +290,129 @@ void SkinnedMesh::InitAllMeshes(const aiScene* paiScene) {
         const aiMesh* paiMesh = paiScene->mMeshes[i];
         InitSingleMesh(i, paiMesh);
     }
+    BucketTrianglesByInfluences();
+    PartitionMeshesByBones();
+}
+
+// Smallest bucket whose shader variant blends NumInfluences influences
+static uint InfluenceBucket(uint NumInfluences) {
+    uint Bucket = 0;
+    while (INFLUENCE_BUCKET_SIZE(Bucket) < NumInfluences) Bucket++;
+    return Bucket;
+}
+
+void SkinnedMesh::BucketTrianglesByInfluences() {
+    vector<uint8_t> VertexBuckets(m_SkinnedVertices.size());
+    m_MaxInfluenceBucket = 0;
+    for (size_t v = 0 ; v < m_SkinnedVertices.size() ; v++) {
+        uint Bucket = InfluenceBucket(m_SkinnedVertices[v].Bones.Normalize());
+        VertexBuckets[v] = (uint8_t)Bucket;
+        m_MaxInfluenceBucket = std::max(m_MaxInfluenceBucket, Bucket);
+    }
+
+    // A triangle goes to the bucket of its heaviest vertex. The partition is stable, so the order
+    // aiProcess_ImproveCacheLocality gave each bucket is kept.
+    std::fill(std::begin(m_BucketIndices), std::end(m_BucketIndices), 0);
+    vector<uint8_t> TriangleBuckets;
+    vector<unsigned int> Sorted;
+    for (BasicMeshEntry& Mesh : m_Meshes) {
+        uint NumTriangles = Mesh.NumIndices / 3;
+        unsigned int* pIndices = m_Indices.data() + Mesh.BaseIndex;
+        const uint8_t* pVertexBuckets = VertexBuckets.data() + Mesh.BaseVertex;
+        TriangleBuckets.resize(NumTriangles);
+        for (uint t = 0 ; t < NumTriangles ; t++) {
+            TriangleBuckets[t] = std::max({ pVertexBuckets[pIndices[3 * t]], pVertexBuckets[pIndices[3 * t + 1]],
+                                            pVertexBuckets[pIndices[3 * t + 2]] });
+        }
+
+        Sorted.clear();
+        for (uint b = 0 ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+            uint Begin = (uint)Sorted.size();
+            for (uint t = 0 ; t < NumTriangles ; t++) {
+                if (TriangleBuckets[t] == b) Sorted.insert(Sorted.end(), pIndices + 3 * t, pIndices + 3 * t + 3);
+            }
+            m_BucketIndices[b] += (uint)Sorted.size() - Begin;
+        }
+        std::copy(Sorted.begin(), Sorted.end(), pIndices);
+    }
+
+    printf("Influence buckets: %u, %u, %u and %u indices for 1, 2, 4 and 8 influences\n",
+           m_BucketIndices[0], m_BucketIndices[1], m_BucketIndices[2], m_BucketIndices[3]);
+}
+
+void SkinnedMesh::PartitionMeshesByBones() {
+    vector<SkinnedVertex> Vertices;
+    Vertices.reserve(m_SkinnedVertices.size());
+    // Stamped with the partition that last took them, so they never need clearing
+    vector<uint> VertexPartition(m_SkinnedVertices.size(), ~0u);
+    vector<uint> LocalVertex(m_SkinnedVertices.size());
+    vector<uint> BonePartition(m_BoneOffsets.size(), ~0u);
+    m_Partitions.clear();
+    m_PartitionBones.clear();
+
+    // Triangles are taken in order, a new partition starts when the next one would bring the
+    // current partition past MAX_BONES. Each partition then stays sorted by bucket.
+    uint NewBones[3 * MAX_NUM_BONES_PER_VERTEX];
+    for (BasicMeshEntry& Mesh : m_Meshes) {
+        Mesh.FirstPartition = (uint)m_Partitions.size();
+        unsigned int* pIndices = m_Indices.data() + Mesh.BaseIndex;
+
+        for (uint t = 0 ; t < Mesh.NumIndices / 3 ; t++) {
+            // Bones of triangle t that partition p does not have yet
+            auto CollectNewBones = [&](uint p) {
+                uint NumNew = 0;
+                for (uint c = 0 ; c < 3 ; c++) {
+                    const VertexBoneData& Bones = m_SkinnedVertices[Mesh.BaseVertex + pIndices[3 * t + c]].Bones;
+                    for (uint k = 0 ; k < Bones.NumInfluences() ; k++) {
+                        uint Bone = Bones.BoneIDs[k];
+                        if (BonePartition[Bone] == p || std::find(NewBones, NewBones + NumNew, Bone) != NewBones + NumNew) continue;
+                        NewBones[NumNew++] = Bone;
+                    }
+                }
+                return NumNew;
+            };
+
+            uint p = (uint)m_Partitions.size() - 1;
+            uint NumNew = 0;
+            if (m_Partitions.size() > Mesh.FirstPartition) NumNew = CollectNewBones(p);
+            if (m_Partitions.size() == Mesh.FirstPartition || m_Partitions[p].NumBones + NumNew > MAX_BONES) {
+                MeshPartition Partition;
+                Partition.BaseVertex = (uint)Vertices.size();
+                Partition.BaseIndex = Mesh.BaseIndex + 3 * t;
+                Partition.FirstBone = (uint)m_PartitionBones.size();
+                m_Partitions.push_back(Partition);
+                p = (uint)m_Partitions.size() - 1;
+                NumNew = CollectNewBones(p);
+            }
+
+            MeshPartition& Partition = m_Partitions[p];
+            for (uint i = 0 ; i < NumNew ; i++) {
+                BonePartition[NewBones[i]] = p;
+                m_PartitionBones.push_back(NewBones[i]);
+            }
+            Partition.NumBones += NumNew;
+
+            uint Bucket = 0;
+            for (uint c = 0 ; c < 3 ; c++) {
+                uint v = Mesh.BaseVertex + pIndices[3 * t + c];
+                if (VertexPartition[v] != p) {
+                    VertexPartition[v] = p;
+                    LocalVertex[v] = Partition.NumVertices++;
+                    Vertices.push_back(m_SkinnedVertices[v]);
+                }
+                pIndices[3 * t + c] = LocalVertex[v];
+                Bucket = std::max(Bucket, InfluenceBucket(m_SkinnedVertices[v].Bones.NumInfluences()));
+            }
+            for (uint b = Bucket ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+                Partition.BucketEnds[b] = Mesh.BaseIndex + 3 * t + 3 - Partition.BaseIndex;
+            }
+        }
+        Mesh.NumPartitions = (uint)m_Partitions.size() - Mesh.FirstPartition;
+    }
+
+    printf("%zu palette partitions of up to %d bones, %zu vertices for %zu\n", m_Partitions.size(), MAX_BONES,
+           Vertices.size(), m_SkinnedVertices.size());
+    m_SkinnedVertices.swap(Vertices);
 }
 
 void SkinnedMesh::InitSingleMesh(uint MeshIndex, const aiMesh* paiMesh) {
@@ -206,12 +444,7 @@ void SkinnedMesh::InitSingleMesh(uint MeshIndex, const aiMesh* paiMesh) {
 
 void SkinnedMesh::LoadMeshBones(uint MeshIndex, const aiMesh* pMesh, vector<SkinnedVertex>& SkinnedVertices, int BaseVertex) {
 
-    if (pMesh->mNumBones > MAX_BONES) {
-        printf("The number of bones in the model (%d) is larger than the maximum supported (%d)\n", pMesh->mNumBones, MAX_BONES);
-        printf("Make sure to increase the macro MAX_BONES in the C++ header as well as in the shader to the same value\n");
-        assert(0);
-    }
-
+    // Any number of bones, PartitionMeshesByBones splits the mesh into draws the palette block can hold
     for (uint i = 0 ; i < pMesh->mNumBones ; i++) {
         LoadSingleBone(MeshIndex, pMesh->mBones[i], SkinnedVertices, BaseVertex);
     }
@@ -221,9 +454,9 @@ void SkinnedMesh::LoadSingleBone(uint MeshIndex, const aiBone* pBone,
                                  vector<SkinnedVertex>& SkinnedVertices, int BaseVertex) {
 
     int BoneId = GetBoneId(pBone);
-    if (BoneId == m_BoneInfo.size()) {
-        BoneInfo bi(AiToGlmMat4(pBone->mOffsetMatrix));
-        m_BoneInfo.push_back(bi);
+    if (BoneId == m_BoneOffsets.size()) {
+        m_BoneOffsets.push_back(AiToGlmMat4(pBone->mOffsetMatrix));
+        m_BoneTransforms.push_back(AffineMatrix(0.0f));
     }
 
     for (uint i = 0 ; i < pBone->mNumWeights ; i++) {
@@ -234,17 +467,7 @@ void SkinnedMesh::LoadSingleBone(uint MeshIndex, const aiBone* pBone,
 }
 
 int SkinnedMesh::GetBoneId(const aiBone* pBone) {
-    int BoneIndex = 0;
-    string BoneName(pBone->mName.C_Str());
-
-    if (!m_BoneNameToIndexMap.contains(BoneName)) {
-        BoneIndex = (int)m_BoneNameToIndexMap.size();
-        m_BoneNameToIndexMap[BoneName] = BoneIndex;
-    } else {
-        BoneIndex = m_BoneNameToIndexMap[BoneName];
-    }
-
-    return BoneIndex;
+    return (int)m_BoneNames.Intern(pBone->mName.data, pBone->mName.length);
 }
 
 string GetDirFromFilename(const string& Filename) {
@@ -372,36 +595,331 @@ void SkinnedMesh::LoadColors(const aiMaterial* pMaterial, int index) {
 
 
 void SkinnedMesh::PopulateBuffers() {
+    vector<PackedSkinnedVertex> Packed;
+    vector<PackedExtraInfluences> Extra;
+    PackVertices(Packed, Extra);
+
     glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
 
-    glBufferData(GL_ARRAY_BUFFER, sizeof(m_SkinnedVertices[0]) * m_SkinnedVertices.size(), &m_SkinnedVertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Packed[0]) * Packed.size(), Packed.data(), GL_STATIC_DRAW);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(m_Indices[0]) * m_Indices.size(), &m_Indices[0], GL_STATIC_DRAW);
 
-    size_t NumFloats = 0;
+    const GLsizei Stride = sizeof(PackedSkinnedVertex);
     glEnableVertexAttribArray(POSITION_LOCATION);
-    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
-                          (const void*)(NumFloats * sizeof(float)));
-    NumFloats += 3;
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_UNSIGNED_SHORT, GL_TRUE, Stride,
+                          (const void*)offsetof(PackedSkinnedVertex, Position));
 
     glEnableVertexAttribArray(TEX_COORD_LOCATION);
-    glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
-                          (const void*)(NumFloats * sizeof(float)));
-    NumFloats += 2;
+    glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_HALF_FLOAT, GL_FALSE, Stride,
+                          (const void*)offsetof(PackedSkinnedVertex, TexCoords));
 
     glEnableVertexAttribArray(NORMAL_LOCATION);
-    glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
-                          (const void*)(NumFloats * sizeof(float)));
-    NumFloats += 3;
+    glVertexAttribPointer(NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, Stride,
+                          (const void*)offsetof(PackedSkinnedVertex, Normal));
 
     glEnableVertexAttribArray(BONE_ID_LOCATION);
-    glVertexAttribIPointer(BONE_ID_LOCATION, MAX_NUM_BONES_PER_VERTEX, GL_INT, sizeof(SkinnedVertex),
-                           (const void*)(NumFloats * sizeof(float)));
-    NumFloats += MAX_NUM_BONES_PER_VERTEX;
+    glVertexAttribIPointer(BONE_ID_LOCATION, 4, GL_UNSIGNED_BYTE, Stride,
+                           (const void*)offsetof(PackedSkinnedVertex, BoneIDs));
 
     glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
-    glVertexAttribPointer(BONE_WEIGHT_LOCATION, MAX_NUM_BONES_PER_VERTEX, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex),
-                          (const void*)(NumFloats * sizeof(float)));
+    glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, Stride,
+                          (const void*)offsetof(PackedSkinnedVertex, Weights));
+
+    // Only the 8 influence variants read these
+    if (!Extra.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BONE_VB]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Extra[0]) * Extra.size(), Extra.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(EXTRA_BONE_ID_LOCATION);
+        glVertexAttribIPointer(EXTRA_BONE_ID_LOCATION, 4, GL_UNSIGNED_BYTE, sizeof(PackedExtraInfluences),
+                               (const void*)offsetof(PackedExtraInfluences, BoneIDs));
+
+        glEnableVertexAttribArray(EXTRA_BONE_WEIGHT_LOCATION);
+        glVertexAttribPointer(EXTRA_BONE_WEIGHT_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedExtraInfluences),
+                              (const void*)offsetof(PackedExtraInfluences, Weights));
+    }
+
+    for (const auto& Programs : m_skinningProgs) for (GLuint Program : Programs) SetVertexDecodeUniforms(Program);
+    for (const auto& Programs : m_instancedProgs) for (GLuint Program : Programs) SetVertexDecodeUniforms(Program);
+    for (const auto& Programs : m_feedbackProgs) for (GLuint Program : Programs) SetVertexDecodeUniforms(Program);
+    SetVertexDecodeUniforms(m_computeProg);
+
+    InitSkinningCache();
+}
+
+// Octahedral mapping of a unit vector to [-1, 1]^2, OctDecode in the skinning shaders inverts it
+static glm::vec2 OctEncode(const glm::vec3& n) {
+    float L1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (L1 == 0.0f) return glm::vec2(0.0f);
+    glm::vec2 e(n.x / L1, n.y / L1);
+    if (n.z < 0.0f) {
+        e = glm::vec2((1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return e;
+}
+
+static glm::vec3 OctDecode(const glm::vec2& e) {
+    glm::vec3 v(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    if (v.z < 0.0f) {
+        v.x = (1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        v.y = (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(v);
+}
+
+void SkinnedMesh::PackVertices(vector<PackedSkinnedVertex>& Packed, vector<PackedExtraInfluences>& Extra) {
+    static_assert(sizeof(PackedSkinnedVertex) == 24, "PackedSkinnedVertex must match skinning_compute.glsl");
+    static_assert(MAX_NUM_BONES_PER_VERTEX == 8, "Influences 4 to 7 are PackedExtraInfluences");
+    static_assert(MAX_BONES <= 256, "Packed bone IDs are 8 bits");
+
+    glm::vec3 Max(0.0f);
+    m_PositionMin = glm::vec3(0.0f);
+    if (!m_SkinnedVertices.empty()) m_PositionMin = Max = m_SkinnedVertices[0].Position;
+    for (const SkinnedVertex& Vertex : m_SkinnedVertices) {
+        m_PositionMin = glm::min(m_PositionMin, Vertex.Position);
+        Max = glm::max(Max, Vertex.Position);
+    }
+    m_PositionExtent = Max - m_PositionMin;
+
+    Packed.resize(m_SkinnedVertices.size());
+    Extra.resize(INFLUENCE_BUCKET_SIZE(m_MaxInfluenceBucket) > 4 ? m_SkinnedVertices.size() : 0);
+    // Bone IDs are packed as indices into the palette of the vertex's partition
+    vector<uint> LocalBones(m_BoneOffsets.size());
+    for (uint b = 0 ; b < LocalBones.size() ; b++) LocalBones[b] = b;
+    uint NextPartition = 0;
+    size_t PartitionEnd = 0;
+    for (size_t i = 0 ; i < m_SkinnedVertices.size() ; i++) {
+        SkinnedVertex& Vertex = m_SkinnedVertices[i];
+        PackedSkinnedVertex& Out = Packed[i];
+
+        while (i >= PartitionEnd && NextPartition < m_Partitions.size()) {
+            const MeshPartition& Partition = m_Partitions[NextPartition++];
+            for (uint b = 0 ; b < Partition.NumBones ; b++) LocalBones[m_PartitionBones[Partition.FirstBone + b]] = b;
+            PartitionEnd = Partition.BaseVertex + Partition.NumVertices;
+        }
+        uint8_t BoneIDs[MAX_NUM_BONES_PER_VERTEX];
+        for (uint k = 0 ; k < MAX_NUM_BONES_PER_VERTEX ; k++) {
+            BoneIDs[k] = Vertex.Bones.Weights[k] > 0.0f ? (uint8_t)LocalBones[Vertex.Bones.BoneIDs[k]] : 0;
+        }
+
+        for (int c = 0 ; c < 3 ; c++) {
+            float Unit = m_PositionExtent[c] > 0.0f ? (Vertex.Position[c] - m_PositionMin[c]) / m_PositionExtent[c] : 0.0f;
+            Out.Position[c] = (uint16_t)lroundf(std::clamp(Unit, 0.0f, 1.0f) * 65535.0f);
+            Vertex.Position[c] = m_PositionMin[c] + (float)Out.Position[c] / 65535.0f * m_PositionExtent[c];
+        }
+        Out.Padding = 0;
+
+        Out.Normal = glm::packSnorm2x16(OctEncode(Vertex.Normal));
+        Vertex.Normal = OctDecode(glm::unpackSnorm2x16(Out.Normal));
+        Out.TexCoords = glm::packHalf2x16(Vertex.TexCoords);
+        Vertex.TexCoords = glm::unpackHalf2x16(Out.TexCoords);
+
+        // Rounding error goes to the heaviest influence, the first after Normalize, so the weights
+        // still sum to one
+        VertexBoneData& Bones = Vertex.Bones;
+        uint8_t Weights[MAX_NUM_BONES_PER_VERTEX];
+        int Sum = 0;
+        for (uint k = 0 ; k < MAX_NUM_BONES_PER_VERTEX ; k++) {
+            Weights[k] = (uint8_t)lroundf(std::clamp(Bones.Weights[k], 0.0f, 1.0f) * 255.0f);
+            Sum += Weights[k];
+        }
+        if (Sum > 0) Weights[0] = (uint8_t)(Weights[0] + 255 - Sum);
+        for (uint k = 0 ; k < MAX_NUM_BONES_PER_VERTEX ; k++) {
+            Bones.Weights[k] = (float)Weights[k] / 255.0f;
+        }
+        for (uint k = 0 ; k < 4 ; k++) {
+            Out.BoneIDs[k] = BoneIDs[k];
+            Out.Weights[k] = Weights[k];
+        }
+        if (!Extra.empty()) {
+            for (uint k = 0 ; k < 4 ; k++) {
+                Extra[i].BoneIDs[k] = BoneIDs[4 + k];
+                Extra[i].Weights[k] = Weights[4 + k];
+            }
+        }
+    }
+}
+
+void SkinnedMesh::SetVertexDecodeUniforms(GLuint Program) const {
+    if (Program == 0) return;
+    glProgramUniform3fv(Program, gl::Shader::GetUniformLocation("gPositionMin", Program), 1,
+                        glm::value_ptr(m_PositionMin));
+    glProgramUniform3fv(Program, gl::Shader::GetUniformLocation("gPositionExtent", Program), 1,
+                        glm::value_ptr(m_PositionExtent));
+}
+
+void SkinnedMesh::InitSkinningCache() {
+    // Skinned position then normal, the layout written by both skinning stages
+    const GLsizei CachedVertexSize = 6 * sizeof(float);
+    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[SKINNED_VB]);
+    glBufferData(GL_ARRAY_BUFFER, CachedVertexSize * m_SkinnedVertices.size(), nullptr, GL_DYNAMIC_COPY);
+
+    glGenVertexArrays(1, &m_SkinnedVAO);
+    glBindVertexArray(m_SkinnedVAO);
+
+    glEnableVertexAttribArray(POSITION_LOCATION);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, CachedVertexSize, (const void*)0);
+    glEnableVertexAttribArray(NORMAL_LOCATION);
+    glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, CachedVertexSize, (const void*)(3 * sizeof(float)));
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
+    glEnableVertexAttribArray(TEX_COORD_LOCATION);
+    glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedSkinnedVertex),
+                          (const void*)offsetof(PackedSkinnedVertex, TexCoords));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+
+    glBindVertexArray(m_VAO);
+
+    static_assert(SKIN_INFLUENCES == MAX_NUM_BONES_PER_VERTEX, "CPU skinning kernels expect the vertex influence count");
+    // Kernels loop over the influences of the largest bucket, lighter vertices pad with zero weights
+    uint NumInfluences = INFLUENCE_BUCKET_SIZE(m_MaxInfluenceBucket);
+    m_SkinningVertices.Resize((uint)m_SkinnedVertices.size(), NumInfluences);
+    for (uint i = 0 ; i < m_SkinnedVertices.size() ; i++) {
+        const SkinnedVertex& Vertex = m_SkinnedVertices[i];
+        m_SkinningVertices.Px[i] = Vertex.Position.x;
+        m_SkinningVertices.Py[i] = Vertex.Position.y;
+        m_SkinningVertices.Pz[i] = Vertex.Position.z;
+        m_SkinningVertices.Nx[i] = Vertex.Normal.x;
+        m_SkinningVertices.Ny[i] = Vertex.Normal.y;
+        m_SkinningVertices.Nz[i] = Vertex.Normal.z;
+        for (uint k = 0 ; k < NumInfluences ; k++) {
+            m_SkinningVertices.BoneIDs[k][i] = (int)Vertex.Bones.BoneIDs[k];
+            m_SkinningVertices.Weights[k][i] = Vertex.Bones.Weights[k];
+        }
+    }
+}
+
+void SkinnedMesh::SkinIntoCache(const vector<AffineMatrix>& Transforms, const vector<glm::mat2x4>& DualQuats,
+                                uint PaletteSlot) {
+    bool DualQuaternion = m_SkinningMode == SkinningMode::DualQuaternion;
+
+    if (m_pCpuSkinningJobs) {
+        auto Start = std::chrono::steady_clock::now();
+        SkinVerticesCpu(Transforms, DualQuats, *m_pCpuSkinningJobs, m_CpuSkinned);
+        // Respecifying the whole store orphans the previous one, so the upload never waits on draws
+        // still reading it
+        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[SKINNED_VB]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(SkinnedPoint) * m_CpuSkinned.size(), m_CpuSkinned.data(), GL_STREAM_DRAW);
+        m_CpuSkinningPendingMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        return;
+    }
+
+    if (m_computeProg != 0) {
+        glUseProgram(m_computeProg);
+        glUniform1i(m_computeDualQuaternionLocation, DualQuaternion);
+        glUniform1ui(m_computeNumInfluencesLocation, INFLUENCE_BUCKET_SIZE(m_MaxInfluenceBucket));
+        if (INFLUENCE_BUCKET_SIZE(m_MaxInfluenceBucket) > 4) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_Buffers[BONE_VB]);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_Buffers[POS_VB]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_Buffers[SKINNED_VB]);
+        // One dispatch per partition, each reading its own palette
+        for (uint p = 0 ; p < m_Partitions.size() ; p++) {
+            const MeshPartition& Partition = m_Partitions[p];
+            if (Partition.NumVertices == 0) continue;
+            BindPalette(PaletteSlot, p);
+            glUniform1ui(m_computeBaseVertexLocation, Partition.BaseVertex);
+            glUniform1ui(m_computeNumVerticesLocation, Partition.NumVertices);
+            glDispatchCompute((Partition.NumVertices + 63) / 64, 1, 1);
+        }
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        return;
+    }
+
+    // Skins every vertex, including those only drawn by lighter buckets
+    glUseProgram(m_feedbackProgs[(int)m_SkinningMode][m_MaxInfluenceBucket]);
+
+    // Every vertex once as a point, nothing is rasterized. Feedback writes from the start of the
+    // bound range, so each partition binds the range of its own vertices.
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(m_VAO);
+    for (uint p = 0 ; p < m_Partitions.size() ; p++) {
+        const MeshPartition& Partition = m_Partitions[p];
+        if (Partition.NumVertices == 0) continue;
+        BindPalette(PaletteSlot, p);
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_Buffers[SKINNED_VB],
+                          (GLintptr)sizeof(SkinnedPoint) * Partition.BaseVertex,
+                          (GLsizeiptr)sizeof(SkinnedPoint) * Partition.NumVertices);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, Partition.BaseVertex, Partition.NumVertices);
+        glEndTransformFeedback();
+    }
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+}
+
+// Same math as skinned_vertex_dq.glsl: blends the influences of one vertex and renormalizes
+static glm::mat2x4 BlendDualQuaternions(const vector<glm::mat2x4>& DualQuats, const uint* pBoneIDs,
+                                        const float* pWeights) {
+    const glm::mat2x4& DQ0 = DualQuats[pBoneIDs[0]];
+    glm::mat2x4 Blended = DQ0 * pWeights[0];
+    for (uint i = 1 ; i < MAX_NUM_BONES_PER_VERTEX ; i++) {
+        const glm::mat2x4& DQ = DualQuats[pBoneIDs[i]];
+        Blended += DQ * (glm::dot(DQ0[0], DQ[0]) < 0.0f ? -pWeights[i] : pWeights[i]);
+    }
+    return Blended * (1.0f / glm::length(Blended[0]));
+}
+
+static glm::vec3 RotateByDualQuaternion(const glm::mat2x4& DQ, const glm::vec3& v) {
+    glm::vec3 r(DQ[0]);
+    return v + 2.0f * glm::cross(r, glm::cross(r, v) + DQ[0].w * v);
+}
+
+static glm::vec3 TransformByDualQuaternion(const glm::mat2x4& DQ, const glm::vec3& p) {
+    glm::vec3 r(DQ[0]), d(DQ[1]);
+    return RotateByDualQuaternion(DQ, p) + 2.0f * (DQ[0].w * d - DQ[1].w * r + glm::cross(r, d));
+}
+
+void SkinnedMesh::SkinVerticesCpu(const vector<AffineMatrix>& Transforms, gl::JobSystem& Jobs,
+                                  vector<SkinnedPoint>& Out) const {
+    vector<glm::mat2x4> DualQuats;
+    if (m_SkinningMode == SkinningMode::DualQuaternion) {
+        DualQuats.resize(Transforms.size());
+        BoneKernels::ComputeDualQuaternions(Transforms.data(), (uint)Transforms.size(), DualQuats.data());
+    }
+    SkinVerticesCpu(Transforms, DualQuats, Jobs, Out);
+}
+
+void SkinnedMesh::SkinVerticesCpu(const vector<AffineMatrix>& Transforms, const vector<glm::mat2x4>& DualQuats,
+                                  gl::JobSystem& Jobs, vector<SkinnedPoint>& Out) const {
+    static_assert(sizeof(SkinnedPoint) == 6 * sizeof(float), "SkinnedPoint must match the kernel output");
+    uint NumVertices = m_SkinningVertices.Size();
+    Out.resize(NumVertices);
+    // Bone IDs index the palette, a mesh without bones has nothing to skin
+    if (NumVertices == 0 || Transforms.empty()) return;
+
+    bool DualQuaternion = m_SkinningMode == SkinningMode::DualQuaternion;
+    float* pOut = reinterpret_cast<float*>(Out.data());
+
+    // Ranges are split in whole SIMD batches so only the last one has a scalar tail
+    constexpr uint BATCHES_PER_JOB = 128;
+    uint NumBatches = (NumVertices + BONE_BATCH_WIDTH - 1) / BONE_BATCH_WIDTH;
+    Jobs.ParallelFor(NumBatches, BATCHES_PER_JOB, [&](uint Begin, uint End, uint) {
+        uint First = Begin * BONE_BATCH_WIDTH;
+        uint Last = std::min(End * BONE_BATCH_WIDTH, NumVertices);
+        if (!DualQuaternion) {
+            BoneKernels::SkinVertices(Transforms.data(), m_SkinningVertices, First, Last, pOut);
+            return;
+        }
+        for (uint i = First ; i < Last ; i++) {
+            const SkinnedVertex& Vertex = m_SkinnedVertices[i];
+            glm::mat2x4 DQ = BlendDualQuaternions(DualQuats, Vertex.Bones.BoneIDs, Vertex.Bones.Weights);
+            Out[i].Position = TransformByDualQuaternion(DQ, Vertex.Position);
+            Out[i].Normal = RotateByDualQuaternion(DQ, Vertex.Normal);
+        }
+    });
+}
+
+void SkinnedMesh::DrawSkinningCache(const glm::mat4& WVP) {
+    assert(m_SkinningCache);
+    UseDrawProgram(m_cachedDrawProg);
+    SetCameraUniforms();
+    glUniformMatrix4fv(WVPLoc, 1, GL_FALSE, glm::value_ptr(WVP));
+    glBindVertexArray(m_SkinnedVAO);
+    DrawMeshes();
+    glBindVertexArray(0);
 }
 
 void SkinnedMesh::Render(const glm::mat4& model,
@@ -412,38 +930,28 @@ void SkinnedMesh::Render(const glm::mat4& model,
                          int endAnim,
                          float blendFactor) {
 
-    m_currentTime = GetCurrentTimeMillis();
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glUseProgram(m_shaderProg);
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glPolygonOffset(1.0, 1.0);
+    BeginDrawTimer();
+    m_NumDrawCalls = 0;
     glm::mat4 WVP = proj * view * model;
-    glUniformMatrix4fv(WVPLoc, 1, GL_FALSE, glm::value_ptr(WVP));
-    auto camLocPos = gl::Camera::get_position();
-    glUniform3f(CameraLocalPosLoc, camLocPos.x, camLocPos.y, camLocPos.z);
-
-    glUniform3fv(glGetUniformLocation(m_shaderProg, "dir"), 1, glm::value_ptr(gl::Camera::getLook()));
 
-    float AnimationTimeSec = (float)((double)m_currentTime - (double)m_startTime) / 1000.0f;
-    float TotalPauseTimeSec = (float)((double)m_totalPauseTime / 1000.0f);
-    AnimationTimeSec -= TotalPauseTimeSec;
+    // Pauses and time scale are already folded in, the clock only moves when it is ticked
+    double AnimationTimeSec = m_Clock.GetTime();
     static float BlendFactor = 0.0f;
     static float BlendDirection = 0.0001f;
 
-    vector<glm::mat4> Transforms;
+    // Evaluated in place, the frame path never copies or allocates a palette
     if(multiAnimations) {
-        GetBoneTransformsBlended(AnimationTimeSec, Transforms, startAnim, endAnim, blendFactor);
+        UpdateBoneTransformsBlended(AnimationTimeSec, startAnim, endAnim, blendFactor);
     } else {
-        GetBoneTransforms(AnimationTimeSec, Transforms, 0);
+        UpdateBoneTransforms(AnimationTimeSec, 0);
     }
-    for (uint i = 0 ; i < Transforms.size() ; i++) {
-        if (i >= MAX_BONES) return;
-        glUniformMatrix4fv(m_boneLocation[i], 1, GL_FALSE, glm::value_ptr(Transforms[i]));
+    const vector<AffineMatrix>& Transforms = m_BoneTransforms;
+    if (m_SkinningMode == SkinningMode::DualQuaternion) {
+        m_DualQuats.resize(Transforms.size());
+        BoneKernels::ComputeDualQuaternions(Transforms.data(), (uint)Transforms.size(), m_DualQuats.data());
     }
 
     BlendFactor += BlendDirection;
@@ -460,7 +968,258 @@ void SkinnedMesh::Render(const glm::mat4& model,
     if (BlendFactor > 1.0f || BlendFactor < 0.0f) BlendDirection *= -1.0f;
     BlendFactor = std::clamp(BlendFactor, 0.0f, 1.0f);
 
+    if (UsesPaletteBuffer()) UploadPalettes(&Transforms, &m_DualQuats, 1);
+    if (m_SkinningCache) {
+        SkinIntoCache(Transforms, m_DualQuats, 0);
+        DrawSkinningCache(WVP);
+    } else {
+        DrawInfluenceBuckets(proj * view, &model, 1);
+    }
+    EndDrawTimer();
+}
+
+void SkinnedMesh::RenderInstances(const glm::mat4& view, const glm::mat4& proj) {
+
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    BeginDrawTimer();
+    m_NumDrawCalls = 0;
+
+    // Keeps the previous frame when no update finished since, the read buffer is ours until the next Acquire
+    m_CrowdFrames.Acquire();
+    CrowdFrame& Frame = m_CrowdFrames.GetReadBuffer();
+    if (m_SkinningMode == SkinningMode::DualQuaternion && !Frame.DualQuaternion) {
+        // Published before the mode switched
+        Frame.DualQuats.resize(Frame.Palettes.size());
+        for (uint i = 0 ; i < Frame.Palettes.size() ; i++) {
+            Frame.DualQuats[i].resize(Frame.Palettes[i].size());
+            BoneKernels::ComputeDualQuaternions(Frame.Palettes[i].data(), (uint)Frame.Palettes[i].size(),
+                                                Frame.DualQuats[i].data());
+        }
+        Frame.DualQuaternion = true;
+    }
+
+    // Every palette of the frame in one write, each draw then only binds its slot
+    uint NumInstances = (uint)Frame.Worlds.size();
+    if (UsesPaletteBuffer() && NumInstances > 0) {
+        UploadPalettes(Frame.Palettes.data(), Frame.DualQuaternion ? Frame.DualQuats.data() : nullptr, NumInstances);
+    }
+
+    glm::mat4 ViewProj = proj * view;
+    if (!m_SkinningCache) {
+        if (m_InstancedDrawing) {
+            DrawInstancedBuckets(ViewProj, Frame.Worlds.data(), NumInstances);
+        } else {
+            DrawInfluenceBuckets(ViewProj, Frame.Worlds.data(), NumInstances);
+        }
+        EndDrawTimer();
+        return;
+    }
+
+    UseDrawProgram(m_cachedDrawProg);
+    SetCameraUniforms();
+    for (uint i = 0 ; i < NumInstances ; i++) {
+        // Only read in dual quaternion mode
+        const vector<glm::mat2x4>& DualQuats = Frame.DualQuaternion ? Frame.DualQuats[i] : m_DualQuats;
+        // The skinning stage binds its own program and vertex array
+        SkinIntoCache(Frame.Palettes[i], DualQuats, i);
+        glUseProgram(m_shaderProg);
+        glBindVertexArray(m_SkinnedVAO);
+        glm::mat4 WVP = ViewProj * Frame.Worlds[i];
+        glUniformMatrix4fv(WVPLoc, 1, GL_FALSE, glm::value_ptr(WVP));
+        DrawMeshes();
+    }
+
+    glBindVertexArray(0);
+    EndDrawTimer();
+}
+
+void SkinnedMesh::DrawInfluenceBuckets(const glm::mat4& ViewProj, const glm::mat4* pWorlds, uint Count) {
     glBindVertexArray(m_VAO);
+    for (uint b = 0 ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+        if (m_BucketIndices[b] == 0) continue;
+        UseDrawProgram(m_skinningProgs[(int)m_SkinningMode][b]);
+        SetCameraUniforms();
+        for (uint i = 0 ; i < Count ; i++) {
+            glm::mat4 WVP = ViewProj * pWorlds[i];
+            glUniformMatrix4fv(WVPLoc, 1, GL_FALSE, glm::value_ptr(WVP));
+            DrawMeshes((int)b, (int)i);
+        }
+    }
+    glBindVertexArray(0);
+}
+
+void SkinnedMesh::DrawInstancedBuckets(const glm::mat4& ViewProj, const glm::mat4* pWorlds, uint Count) {
+    if (Count == 0) return;
+
+    size_t WorldBytes = sizeof(glm::mat4) * Count;
+    unsigned char* pWorldSlots = m_InstanceWorldBuffer.Map(WorldBytes);
+    memcpy(pWorldSlots, pWorlds, WorldBytes);
+    m_InstanceWorldBuffer.Flush(0, WorldBytes);
+    m_InstanceWorldBuffer.Unmap();
+
+    // Texels past GL_MAX_TEXTURE_BUFFER_SIZE read as zero
+    GLintptr PaletteEnd = m_PaletteBuffer.GetOffset() + GetPaletteStride() * Count;
+    GLintptr WorldEnd = m_InstanceWorldBuffer.GetOffset() + (GLintptr)WorldBytes;
+    if ((GLintptr)(std::max(PaletteEnd, WorldEnd) / PALETTE_TEXEL_SIZE) > m_MaxTextureBufferTexels) {
+        DrawInfluenceBuckets(ViewProj, pWorlds, Count);
+        return;
+    }
+
+    // The stream buffers are reallocated as the crowd grows, so the textures are attached every frame
+    glActiveTexture(GL_TEXTURE0 + PALETTE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_PaletteTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_PaletteBuffer.GetBuffer());
+    glActiveTexture(GL_TEXTURE0 + INSTANCE_WORLD_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_InstanceWorldTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_InstanceWorldBuffer.GetBuffer());
+
+    glBindVertexArray(m_VAO);
+    for (uint b = 0 ; b < NUM_INFLUENCE_BUCKETS ; b++) {
+        if (m_BucketIndices[b] == 0) continue;
+        UseDrawProgram(m_instancedProgs[(int)m_SkinningMode][b]);
+        SetCameraUniforms();
+        glUniformMatrix4fv(WVPLoc, 1, GL_FALSE, glm::value_ptr(ViewProj));
+        glUniform1i(PaletteStrideLoc, (GLint)(GetPaletteStride() / PALETTE_TEXEL_SIZE));
+        glUniform1i(WorldBaseLoc, (GLint)(m_InstanceWorldBuffer.GetOffset() / PALETTE_TEXEL_SIZE));
+        DrawMeshes((int)b, 0, Count);
+    }
+    glBindVertexArray(0);
+}
+
+void SkinnedMesh::SetCameraUniforms() {
+    glUseProgram(m_shaderProg);
+    auto camLocPos = gl::Camera::get_position();
+    glUniform3f(CameraLocalPosLoc, camLocPos.x, camLocPos.y, camLocPos.z);
+    glUniform3fv(glGetUniformLocation(m_shaderProg, "dir"), 1, glm::value_ptr(gl::Camera::getLook()));
+}
+
+void SkinnedMesh::UploadPalettes(const vector<AffineMatrix>* pTransforms, const vector<glm::mat2x4>* pDualQuats,
+                                 uint Count) {
+    bool DualQuaternion = m_SkinningMode == SkinningMode::DualQuaternion;
+    size_t EntrySize = DualQuaternion ? sizeof(glm::mat2x4) : sizeof(AffineMatrix);
+    uint NumEntries = (uint)m_PartitionBones.size();
+    size_t SlotStride = (size_t)GetPaletteStride();
+
+    unsigned char* pSlots = m_PaletteBuffer.Map(SlotStride * Count);
+    uint64_t Frame = m_PaletteBuffer.GetFrame();
+    uint64_t RegionFrame = m_PaletteBuffer.GetRegionFrame();
+
+    // Slots that now hold other characters, another kind of entry or another mesh start over
+    if (Count != m_PaletteShadowSlots || DualQuaternion != m_PaletteShadowDualQuats ||
+        m_PaletteChangedFrame.size() != (size_t)Count * NumEntries) {
+        m_PaletteShadow.assign((size_t)Count * NumEntries * EntrySize, 0);
+        m_PaletteChangedFrame.assign((size_t)Count * NumEntries, Frame);
+        m_PaletteShadowSlots = Count;
+        m_PaletteShadowDualQuats = DualQuaternion;
+    }
+
+    m_PaletteUploadBytes = 0;
+    for (uint i = 0 ; i < Count ; i++) {
+        const unsigned char* pSource = DualQuaternion ? (const unsigned char*)pDualQuats[i].data()
+                                                      : (const unsigned char*)pTransforms[i].data();
+        unsigned char* pShadow = m_PaletteShadow.data() + (size_t)i * NumEntries * EntrySize;
+        uint64_t* pChanged = m_PaletteChangedFrame.data() + (size_t)i * NumEntries;
+
+        // Held palettes, paused characters and static bones compare equal and stay as they are
+        for (uint e = 0 ; e < NumEntries ; e++) {
+            const unsigned char* pEntry = pSource + (size_t)m_PartitionBones[e] * EntrySize;
+            if (memcmp(pShadow + e * EntrySize, pEntry, EntrySize) == 0) continue;
+            memcpy(pShadow + e * EntrySize, pEntry, EntrySize);
+            pChanged[e] = Frame;
+        }
+
+        // The region last got this slot at RegionFrame, runs of entries changed since are written
+        // and flushed together. Runs end with their partition, the next one starts a new block.
+        for (uint p = 0 ; p < m_Partitions.size() ; p++) {
+            const MeshPartition& Partition = m_Partitions[p];
+            const uint64_t* pPartitionChanged = pChanged + Partition.FirstBone;
+            uint b = 0;
+            while (b < Partition.NumBones) {
+                if (pPartitionChanged[b] <= RegionFrame) {
+                    b++;
+                    continue;
+                }
+                uint End = b + 1;
+                while (End < Partition.NumBones && pPartitionChanged[End] > RegionFrame) End++;
+
+                size_t Offset = SlotStride * i + (size_t)m_PartitionStride * p + b * EntrySize;
+                size_t Bytes = (End - b) * EntrySize;
+                memcpy(pSlots + Offset, pShadow + (size_t)(Partition.FirstBone + b) * EntrySize, Bytes);
+                m_PaletteBuffer.Flush(Offset, Bytes);
+                m_PaletteUploadBytes += Bytes;
+                b = End;
+            }
+        }
+    }
+
+    m_PaletteBuffer.Unmap();
+}
+
+void SkinnedMesh::BindPalette(uint Index, uint Partition) {
+    GLintptr Offset = m_PaletteBuffer.GetOffset() + GetPaletteStride() * Index + m_PartitionStride * Partition;
+    glBindBufferRange(GL_UNIFORM_BUFFER, PALETTE_BLOCK_BINDING, m_PaletteBuffer.GetBuffer(), Offset, m_PartitionStride);
+    if (m_computeProg != 0) {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, PALETTE_STORAGE_BINDING, m_PaletteBuffer.GetBuffer(), Offset,
+                          m_PartitionStride);
+    }
+}
+
+void SkinnedMesh::BeginDrawTimer() {
+    // Collect the query issued by the previous call if the GPU is done with it, never block on it
+    GLuint Previous = m_drawTimerQueries[(m_drawTimerFrame + 1) % 2];
+    if (m_drawTimerFrame > 0) {
+        GLint Available = 0;
+        glGetQueryObjectiv(Previous, GL_QUERY_RESULT_AVAILABLE, &Available);
+        if (Available) {
+            GLuint64 Nanoseconds = 0;
+            glGetQueryObjectui64v(Previous, GL_QUERY_RESULT, &Nanoseconds);
+            m_DrawTimeMs = (double)Nanoseconds / 1.0e6;
+        }
+    }
+    glBeginQuery(GL_TIME_ELAPSED, m_drawTimerQueries[m_drawTimerFrame % 2]);
+}
+
+void SkinnedMesh::EndDrawTimer() {
+    glEndQuery(GL_TIME_ELAPSED);
+    m_drawTimerFrame++;
+    m_CpuSkinningMs = m_CpuSkinningPendingMs;
+    m_CpuSkinningPendingMs = 0.0;
+}
+
+void SkinnedMesh::MeasureSkinningError(float& MaxError, float& MeanError) const {
+    MaxError = 0.0f;
+    MeanError = 0.0f;
+    if (m_SkinnedVertices.empty() || m_BoneTransforms.empty()) return;
+
+    vector<glm::mat2x4> DualQuats(m_BoneTransforms.size());
+    BoneKernels::ComputeDualQuaternions(m_BoneTransforms.data(), (uint)m_BoneTransforms.size(), DualQuats.data());
+
+    double Total = 0.0;
+    for (const SkinnedVertex& Vertex : m_SkinnedVertices) {
+        const VertexBoneData& Bones = Vertex.Bones;
+        AffineMatrix BoneTransform(0.0f);
+        for (uint i = 0 ; i < MAX_NUM_BONES_PER_VERTEX ; i++) {
+            BoneTransform += m_BoneTransforms[Bones.BoneIDs[i]] * Bones.Weights[i];
+        }
+        glm::vec3 Linear = glm::vec4(Vertex.Position, 1.0f) * BoneTransform;
+        glm::vec3 Dual = TransformByDualQuaternion(BlendDualQuaternions(DualQuats, Bones.BoneIDs, Bones.Weights),
+                                                   Vertex.Position);
+
+        float Error = glm::length(Linear - Dual);
+        MaxError = std::max(MaxError, Error);
+        Total += Error;
+    }
+    MeanError = (float)(Total / (double)m_SkinnedVertices.size());
+}
+
+void SkinnedMesh::DrawMeshes(int Bucket, int PaletteSlot, uint NumInstances) {
+    auto GetRange = [Bucket](const MeshPartition& Partition, uint& Begin, uint& End) {
+        Begin = Bucket > 0 ? Partition.BucketEnds[Bucket - 1] : 0;
+        End = Partition.BucketEnds[Bucket >= 0 ? Bucket : NUM_INFLUENCE_BUCKETS - 1];
+    };
+
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     glEnable(GL_POLYGON_OFFSET_FILL);
     glEnable(GL_DEPTH_TEST);
@@ -468,6 +1227,14 @@ void SkinnedMesh::Render(const glm::mat4& model,
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glPolygonOffset(1.0, 1.0);
     for (auto & m_Meshe : m_Meshes) {
+        uint Begin, End;
+        uint NumIndices = 0;
+        for (uint p = m_Meshe.FirstPartition ; p < m_Meshe.FirstPartition + m_Meshe.NumPartitions ; p++) {
+            GetRange(m_Partitions[p], Begin, End);
+            NumIndices += End - Begin;
+        }
+        if (NumIndices == 0) continue;
+
         unsigned int MaterialIndex = m_Meshe.MaterialIndex;
 
         assert(MaterialIndex < m_Materials.size());
@@ -489,11 +1256,23 @@ void SkinnedMesh::Render(const glm::mat4& model,
         glUniform3f(materialLoc.DiffuseColor, mat.DiffuseColor.r, mat.DiffuseColor.g, mat.DiffuseColor.b);
         glUniform3f(materialLoc.SpecularColor, mat.SpecularColor.r, mat.SpecularColor.g, mat.SpecularColor.b);
 
-        glDrawElementsBaseVertex(GL_TRIANGLES, m_Meshe.NumIndices, GL_UNSIGNED_INT,
-                                 (void*)(sizeof(unsigned int) * m_Meshe.BaseIndex),
-                                 m_Meshe.BaseVertex);
+        for (uint p = m_Meshe.FirstPartition ; p < m_Meshe.FirstPartition + m_Meshe.NumPartitions ; p++) {
+            const MeshPartition& Partition = m_Partitions[p];
+            GetRange(Partition, Begin, End);
+            if (Begin == End) continue;
+            void* pFirstIndex = (void*)(sizeof(unsigned int) * (Partition.BaseIndex + Begin));
+            m_NumDrawCalls++;
+            if (NumInstances > 0) {
+                GLintptr Offset = m_PaletteBuffer.GetOffset() + GetPaletteStride() * PaletteSlot + m_PartitionStride * p;
+                glUniform1i(PaletteBaseLoc, (GLint)(Offset / PALETTE_TEXEL_SIZE));
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, End - Begin, GL_UNSIGNED_INT, pFirstIndex, NumInstances,
+                                                  Partition.BaseVertex);
+                continue;
+            }
+            if (PaletteSlot >= 0) BindPalette((uint)PaletteSlot, p);
+            glDrawElementsBaseVertex(GL_TRIANGLES, End - Begin, GL_UNSIGNED_INT, pFirstIndex, Partition.BaseVertex);
+        }
     }
-    glBindVertexArray(0);
 }
 
 
@@ -505,293 +1284,792 @@ const Material& SkinnedMesh::GetMaterial() {
 }
 
 
-uint SkinnedMesh::FindPosition(float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+void SkinnedMesh::InitScratch(PoseScratch& Scratch) const {
+    uint NumNodes = m_Skeleton.NumNodes();
+    Scratch.LocalTRS = m_Skeleton.BindLocals;
+    Scratch.LocalTransforms.resize(NumNodes);
+    Scratch.GlobalTransforms.resize(NumNodes);
+    // A clip has at most one track per node, so sampling any clip into it never allocates
+    Scratch.Pose.Resize(NumNodes);
+}
+
+void SkinnedMesh::ReserveBlendScratch(PoseScratch& Scratch, uint NumPoses) const {
+    if (Scratch.BlendPoses.size() >= NumPoses) return;
+    Scratch.BlendInputs.reserve(NumPoses);
+    Scratch.BlendLayers.reserve(NumPoses);
+    Scratch.BlendPoses.resize(NumPoses);
+    for (LocalPose& Pose : Scratch.BlendPoses) Pose.Resize(m_Skeleton.NumNodes());
+}
+
+// Runs the batched kernels over the first NumAnimatedNodes entries of Scratch.LocalTRS, which the
+// caller has filled with the current pose. Any detail nodes past them follow their anchors rigidly.
+void SkinnedMesh::UpdatePalette(uint NumAnimatedNodes, PoseScratch& Scratch, const int* pBoneNodes,
+                                AffineMatrix* pPalette) const {
+    glm::mat4* pGlobals = Scratch.GlobalTransforms.data();
+    BoneKernels::ComposeLocals(Scratch.LocalTRS, NumAnimatedNodes, Scratch.LocalTransforms.data());
+    BoneKernels::ConcatenateGlobals(m_Skeleton.Parents.data(), Scratch.LocalTransforms.data(), NumAnimatedNodes,
+                                    pGlobals);
+
+    for (uint i = NumAnimatedNodes ; i < m_Skeleton.NumNodes() ; i++) {
+        uint Detail = i - m_Skeleton.NumCoreNodes;
+        pGlobals[i] = pGlobals[m_Skeleton.DetailAnchors[Detail]] * m_Skeleton.DetailFromAnchor[Detail];
+    }
+
+    BoneKernels::ComputePalette(m_GlobalInverseTransform, pGlobals, pBoneNodes, m_BoneOffsets.data(),
+                                (uint)m_BoneOffsets.size(), pPalette);
+}
 
-    for (uint i = 0 ; i < pNodeAnim->mNumPositionKeys - 1 ; i++) {
-        float t = (float)pNodeAnim->mPositionKeys[i + 1].mTime;
-        if (AnimationTimeTicks < t) {
-            return i;
+void SkinnedMesh::BuildPoseCache() {
+    m_PoseCache.clear();
+    m_PoseCacheBytes = 0;
+    if (m_PoseCacheBudget == 0 || m_PoseCacheRate <= 0.0f || m_BoneOffsets.empty()) return;
+
+    uint NumBones = (uint)m_BoneOffsets.size();
+    uint NumCached = 0;
+    m_PoseCache.resize(m_Clips.size());
+
+    for (uint a = 0 ; a < m_Clips.size() ; a++) {
+        const AnimationClip& Clip = *m_Clips[a];
+        // Same loop length as CalcAnimationTimeTicks
+        float LoopTicks = floorf(Clip.DurationTicks());
+        if (LoopTicks <= 0.0f || Clip.TicksPerSecond() <= 0.0f) continue;
+
+        uint NumFrames = max(1u, (uint)ceilf(LoopTicks / Clip.TicksPerSecond() * m_PoseCacheRate)) + 1;
+        size_t Bytes = (size_t)NumFrames * NumBones * sizeof(AffineMatrix);
+        // A shorter clip further on may still fit
+        if (m_PoseCacheBytes + Bytes > m_PoseCacheBudget) continue;
+
+        CachedClip& Cache = m_PoseCache[a];
+        Cache.Palettes.assign((size_t)NumFrames * NumBones, AffineMatrix(0.0f));
+        for (uint f = 0 ; f < NumFrames ; f++) {
+            float TimeTicks = LoopTicks * (float)f / (float)(NumFrames - 1);
+            EvaluateSkeleton(TimeTicks, a, false, m_Scratch, &Cache.Palettes[(size_t)f * NumBones]);
         }
+        // Published last, EvaluateSkeleton above must still sample the clip
+        Cache.FramesPerTick = (float)(NumFrames - 1) / LoopTicks;
+        Cache.NumFrames = NumFrames;
+        m_PoseCacheBytes += Bytes;
+        NumCached++;
     }
-    return 0;
+
+    printf("Pose cache: %u of %zu clips, %zu bytes\n", NumCached, m_Clips.size(), m_PoseCacheBytes);
 }
 
+bool SkinnedMesh::SamplePoseCache(float AnimationTimeTicks, uint AnimationIndex, AffineMatrix* pPalette) const {
+    if (AnimationIndex >= m_PoseCache.size() || m_PoseCache[AnimationIndex].NumFrames == 0) return false;
 
-void SkinnedMesh::CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+    const CachedClip& Cache = m_PoseCache[AnimationIndex];
+    float Frame = max(AnimationTimeTicks * Cache.FramesPerTick, 0.0f);
+    uint From = min((uint)Frame, Cache.NumFrames - 2);
+    float Factor = Frame - (float)From;
 
-    if (pNodeAnim->mNumPositionKeys == 1) {
-        Out = pNodeAnim->mPositionKeys[0].mValue;
-        return;
+    uint NumBones = (uint)m_BoneOffsets.size();
+    const AffineMatrix* pFrom = &Cache.Palettes[(size_t)From * NumBones];
+    const AffineMatrix* pTo = pFrom + NumBones;
+    for (uint b = 0 ; b < NumBones ; b++) {
+        pPalette[b] = pFrom[b] + (pTo[b] - pFrom[b]) * Factor;
     }
+    return true;
+}
 
-    uint PositionIndex = FindPosition(AnimationTimeTicks, pNodeAnim);
-    uint NextPositionIndex = PositionIndex + 1;
-    assert(NextPositionIndex < pNodeAnim->mNumPositionKeys);
-    float t1 = (float)pNodeAnim->mPositionKeys[PositionIndex].mTime;
-    if (t1 > AnimationTimeTicks) {
-        Out = pNodeAnim->mPositionKeys[PositionIndex].mValue;
-    } else {
-        float t2 = (float)pNodeAnim->mPositionKeys[NextPositionIndex].mTime;
-        float DeltaTime = t2 - t1;
-        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
-        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiVector3D& Start = pNodeAnim->mPositionKeys[PositionIndex].mValue;
-        const aiVector3D& End = pNodeAnim->mPositionKeys[NextPositionIndex].mValue;
-        aiVector3D Delta = End - Start;
-        Out = Start + Factor * Delta;
-    }
+uint SkinnedMesh::NumTracksToSample(uint AnimationIndex, bool SkipDetailBones) const {
+    return SkipDetailBones ? m_NumCoreTracks[AnimationIndex] : m_Clips[AnimationIndex]->NumTracks();
 }
 
+void SkinnedMesh::EvaluateSkeleton(float AnimationTimeTicks, uint AnimationIndex, bool SkipDetailBones,
+                                   PoseScratch& Scratch, AffineMatrix* pPalette, bool KeepStaticBones) const {
+
+    if (SamplePoseCache(AnimationTimeTicks, AnimationIndex, pPalette)) return;
 
-uint SkinnedMesh::FindRotation(float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+    const ClipNodes& Clip = m_ClipNodes[AnimationIndex];
+    const AnimationClip& Source = *m_Clips[AnimationIndex];
+    uint NumAnimatedNodes = SkipDetailBones ? Clip.NumCoreNodes : (uint)Clip.Nodes.size();
+    LocalPose& Pose = Scratch.Pose;
+    Source.SampleTracks(AnimationTimeTicks, Pose, 0, Clip.NumDynamicTracks);
+    if (!SkipDetailBones) {
+        Source.SampleTracks(AnimationTimeTicks, Pose, m_NumCoreTracks[AnimationIndex], Source.NumTracks());
+    }
 
-    assert(pNodeAnim->mNumRotationKeys > 0);
-    for (uint i = 0 ; i < pNodeAnim->mNumRotationKeys - 1 ; i++) {
-        float t = (float)pNodeAnim->mRotationKeys[i + 1].mTime;
-        if (AnimationTimeTicks < t) {
-            return i;
+    // Indexed like Clip.Nodes from here on
+    Scratch.LocalTRS = Clip.BindLocals;
+    for (uint k = 0 ; k < NumAnimatedNodes ; k++) {
+        int Track = GetTrack(AnimationIndex, (uint)Clip.Nodes[k]);
+        if (Track >= 0) {
+            Scratch.LocalTRS.Set(k, Pose.Translations[Track], Pose.Rotations[Track], Pose.Scales[Track]);
         }
     }
-    return 0;
+
+    glm::mat4* pLocals = Scratch.LocalTransforms.data();
+    glm::mat4* pGlobals = Scratch.GlobalTransforms.data();
+    BoneKernels::ComposeLocals(Scratch.LocalTRS, NumAnimatedNodes, pLocals);
+    // A node below a static one starts from that node's global instead of a parent in Nodes
+    for (uint j = 0 ; j < Clip.AttachedNodes.size() && Clip.AttachedNodes[j] < NumAnimatedNodes ; j++) {
+        pLocals[Clip.AttachedNodes[j]] = Clip.AttachGlobals[j] * pLocals[Clip.AttachedNodes[j]];
+    }
+    BoneKernels::ConcatenateGlobals(Clip.Parents.data(), pLocals, NumAnimatedNodes, pGlobals);
+
+    for (uint k = NumAnimatedNodes ; k < Clip.Nodes.size() ; k++) {
+        uint Detail = k - Clip.NumCoreNodes;
+        int Anchor = Clip.DetailAnchors[Detail];
+        pGlobals[k] = Anchor >= 0 ? pGlobals[Anchor] * Clip.DetailFromAnchor[Detail] : Clip.DetailFromAnchor[Detail];
+    }
+
+    BoneKernels::ComputePalette(m_GlobalInverseTransform, pGlobals, Clip.BoneNodes.data(), m_BoneOffsets.data(),
+                                (uint)m_BoneOffsets.size(), pPalette);
+    if (!KeepStaticBones) {
+        for (uint j = 0 ; j < Clip.StaticBones.size() ; j++) pPalette[Clip.StaticBones[j]] = Clip.StaticPalette[j];
+    }
+}
+
+// Shortest-path normalized lerp, close to slerp for the angles between blended poses
+static glm::quat NLerp(const glm::quat& From, const glm::quat& To, float Factor) {
+    glm::quat End = glm::dot(From, To) < 0.0f ? -To : To;
+    return glm::normalize(From * (1.0f - Factor) + End * Factor);
 }
 
+void SkinnedMesh::EvaluateBlend(double TimeInSeconds, const BlendInput* pInputs, uint NumInputs,
+                                const BlendLayer* pLayers, uint NumLayers, bool SkipDetailBones,
+                                PoseScratch& Scratch, AffineMatrix* pPalette) const {
+
+    ReserveBlendScratch(Scratch, NumInputs + NumLayers);
+
+    // Keep what contributes, with the input weights normalized so they sum to one
+    float TotalWeight = 0.0f;
+    Scratch.BlendInputs.clear();
+    for (uint i = 0 ; i < NumInputs ; i++) {
+        if (pInputs[i].Weight <= 0.0f) continue;
+        Scratch.BlendInputs.push_back(pInputs[i]);
+        TotalWeight += pInputs[i].Weight;
+    }
+    for (BlendInput& Input : Scratch.BlendInputs) Input.Weight /= TotalWeight;
 
-void SkinnedMesh::CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+    Scratch.BlendLayers.clear();
+    for (uint i = 0 ; i < NumLayers ; i++) {
+        if (pLayers[i].Weight <= 0.0f) continue;
+        Scratch.BlendLayers.push_back(pLayers[i]);
+        Scratch.BlendLayers.back().Weight = std::min(pLayers[i].Weight, 1.0f);
+    }
 
-    if (pNodeAnim->mNumRotationKeys == 1) {
-        Out = pNodeAnim->mRotationKeys[0].mValue;
+    uint NumBlendInputs = (uint)Scratch.BlendInputs.size();
+    if (NumBlendInputs == 1 && Scratch.BlendLayers.empty()) {
+        uint AnimationIndex = Scratch.BlendInputs[0].AnimationIndex;
+        EvaluateSkeleton(CalcAnimationTimeTicks(TimeInSeconds, AnimationIndex), AnimationIndex, SkipDetailBones,
+                         Scratch, pPalette);
         return;
     }
 
-    uint RotationIndex = FindRotation(AnimationTimeTicks, pNodeAnim);
-    uint NextRotationIndex = RotationIndex + 1;
-    assert(NextRotationIndex < pNodeAnim->mNumRotationKeys);
-    float t1 = (float)pNodeAnim->mRotationKeys[RotationIndex].mTime;
-    if (t1 > AnimationTimeTicks) {
-        Out = pNodeAnim->mRotationKeys[RotationIndex].mValue;
-    } else {
-        float t2 = (float)pNodeAnim->mRotationKeys[NextRotationIndex].mTime;
-        float DeltaTime = t2 - t1;
-        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
-        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiQuaternion& StartRotationQ = pNodeAnim->mRotationKeys[RotationIndex].mValue;
-        const aiQuaternion& EndRotationQ   = pNodeAnim->mRotationKeys[NextRotationIndex].mValue;
-        aiQuaternion::Interpolate(Out, StartRotationQ, EndRotationQ, Factor);
+    // Every clip is sampled once, then the whole blend is done in one pass over the nodes
+    uint NumPoses = NumBlendInputs + (uint)Scratch.BlendLayers.size();
+    for (uint k = 0 ; k < NumPoses ; k++) {
+        uint AnimationIndex = k < NumBlendInputs ? Scratch.BlendInputs[k].AnimationIndex
+                                                 : Scratch.BlendLayers[k - NumBlendInputs].AnimationIndex;
+        m_Clips[AnimationIndex]->SamplePose(CalcAnimationTimeTicks(TimeInSeconds, AnimationIndex),
+                                            Scratch.BlendPoses[k], NumTracksToSample(AnimationIndex, SkipDetailBones));
     }
-    Out.Normalize();
-}
 
-uint SkinnedMesh::FindScaling(float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+    uint NumAnimatedNodes = SkipDetailBones ? m_Skeleton.NumCoreNodes : m_Skeleton.NumNodes();
+    NodeTRS& Locals = Scratch.LocalTRS;
+    Locals = m_Skeleton.BindLocals;
+
+    for (uint i = 0 ; i < NumAnimatedNodes ; i++) {
+        glm::vec3 Translation(Locals.Tx[i], Locals.Ty[i], Locals.Tz[i]);
+        glm::quat Rotation(Locals.Qw[i], Locals.Qx[i], Locals.Qy[i], Locals.Qz[i]);
+        glm::vec3 Scaling(Locals.Sx[i], Locals.Sy[i], Locals.Sz[i]);
+        bool Animated = false;
+
+        // Inputs that do not animate the node blend in its bind pose
+        for (uint k = 0 ; k < NumBlendInputs && !Animated ; k++) {
+            Animated = GetTrack(Scratch.BlendInputs[k].AnimationIndex, i) >= 0;
+        }
+
+        if (Animated) {
+            glm::vec3 BindTranslation = Translation, BindScaling = Scaling;
+            glm::quat BindRotation = Rotation;
+            Translation = glm::vec3(0.0f);
+            Scaling = glm::vec3(0.0f);
+            Rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
+
+            for (uint k = 0 ; k < NumBlendInputs ; k++) {
+                const LocalPose& Pose = Scratch.BlendPoses[k];
+                int Track = GetTrack(Scratch.BlendInputs[k].AnimationIndex, i);
+                float Weight = Scratch.BlendInputs[k].Weight;
+                const glm::quat& InputRotation = Track >= 0 ? Pose.Rotations[Track] : BindRotation;
+
+                Translation += Weight * (Track >= 0 ? Pose.Translations[Track] : BindTranslation);
+                Scaling += Weight * (Track >= 0 ? Pose.Scales[Track] : BindScaling);
+                // q and -q are the same rotation, keep the sum in one hemisphere
+                Rotation = Rotation + InputRotation * (glm::dot(Rotation, InputRotation) < 0.0f ? -Weight : Weight);
+            }
+            Rotation = glm::normalize(Rotation);
+        }
 
-    assert(pNodeAnim->mNumScalingKeys > 0);
-    for (uint i = 0 ; i < pNodeAnim->mNumScalingKeys - 1 ; i++) {
-        float t = (float)pNodeAnim->mScalingKeys[i + 1].mTime;
-        if (AnimationTimeTicks < t) {
-            return i;
+        for (uint l = 0 ; l < Scratch.BlendLayers.size() ; l++) {
+            const BlendLayer& Layer = Scratch.BlendLayers[l];
+            int Track = GetTrack(Layer.AnimationIndex, i);
+            float Weight = Layer.Mask >= 0 ? Layer.Weight * m_BoneMasks[Layer.Mask][i] : Layer.Weight;
+            if (Track < 0 || Weight <= 0.0f) continue;
+
+            const LocalPose& Pose = Scratch.BlendPoses[NumBlendInputs + l];
+            if (Layer.Mode == BlendLayerMode::Override) {
+                Translation = glm::mix(Translation, Pose.Translations[Track], Weight);
+                Rotation = NLerp(Rotation, Pose.Rotations[Track], Weight);
+                Scaling = glm::mix(Scaling, Pose.Scales[Track], Weight);
+            } else {
+                const LocalPose& Reference = m_ReferencePoses[Layer.AnimationIndex];
+                glm::quat Delta = Pose.Rotations[Track] * glm::conjugate(Reference.Rotations[Track]);
+                Translation += Weight * (Pose.Translations[Track] - Reference.Translations[Track]);
+                Rotation = NLerp(glm::quat(1.0f, 0.0f, 0.0f, 0.0f), Delta, Weight) * Rotation;
+                Scaling = Scaling * glm::mix(glm::vec3(1.0f), Pose.Scales[Track] / Reference.Scales[Track], Weight);
+            }
+            Animated = true;
         }
+
+        if (Animated) Locals.Set(i, Translation, Rotation, Scaling);
     }
-    return 0;
+
+    UpdatePalette(NumAnimatedNodes, Scratch, m_Skeleton.BoneNodes.data(), pPalette);
 }
 
-void SkinnedMesh::CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
+void SkinnedMesh::EvaluateInstance(AnimationInstance& Instance, bool SkipDetailBones, PoseScratch& Scratch) const {
+    Instance.BoneTransforms.resize(m_BoneOffsets.size(), AffineMatrix(0.0f));
+
+    const BlendTree& Blend = Instance.Blend;
+    if (!Blend.Inputs.empty()) {
+        EvaluateBlend(Instance.TimeInSeconds, Blend.Inputs.data(), (uint)Blend.Inputs.size(), Blend.Layers.data(),
+                      (uint)Blend.Layers.size(), SkipDetailBones, Scratch, Instance.BoneTransforms.data());
+        Instance.PaletteClip = -1;
+    } else if (Instance.BlendFactor <= 0.0f || Instance.StartAnimIndex == Instance.EndAnimIndex) {
+        float StartTimeTicks = CalcAnimationTimeTicks(Instance.TimeInSeconds, Instance.StartAnimIndex);
+        EvaluateSkeleton(StartTimeTicks, Instance.StartAnimIndex, SkipDetailBones, Scratch,
+                         Instance.BoneTransforms.data(), Instance.PaletteClip == (int)Instance.StartAnimIndex);
+        Instance.PaletteClip = (int)Instance.StartAnimIndex;
+    } else {
+        float BlendFactor = std::min(Instance.BlendFactor, 1.0f);
+        BlendInput Inputs[2] = { { Instance.StartAnimIndex, 1.0f - BlendFactor }, { Instance.EndAnimIndex, BlendFactor } };
+        EvaluateBlend(Instance.TimeInSeconds, Inputs, 2, nullptr, 0, SkipDetailBones, Scratch,
+                      Instance.BoneTransforms.data());
+        Instance.PaletteClip = -1;
+    }
 
-    if (pNodeAnim->mNumScalingKeys == 1) {
-        Out = pNodeAnim->mScalingKeys[0].mValue;
-        return;
+    if (m_SkinningMode == SkinningMode::DualQuaternion) {
+        Instance.DualQuats.resize(Instance.BoneTransforms.size());
+        BoneKernels::ComputeDualQuaternions(Instance.BoneTransforms.data(), (uint)Instance.BoneTransforms.size(),
+                                            Instance.DualQuats.data());
     }
 
-    uint ScalingIndex = FindScaling(AnimationTimeTicks, pNodeAnim);
-    uint NextScalingIndex = ScalingIndex + 1;
-    assert(NextScalingIndex < pNodeAnim->mNumScalingKeys);
-    auto t1 = (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime;
-    if (t1 > AnimationTimeTicks) {
-        Out = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
-    } else {
-        auto t2 = (float)pNodeAnim->mScalingKeys[NextScalingIndex].mTime;
-        float DeltaTime = t2 - t1;
-        float Factor = (AnimationTimeTicks - t1) / DeltaTime;
-        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiVector3D& Start = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
-        const aiVector3D& End   = pNodeAnim->mScalingKeys[NextScalingIndex].mValue;
-        aiVector3D Delta = End - Start;
-        Out = Start + Factor * Delta;
+    // Assigning the blend tree reuses its capacity, so a steady instance does not allocate
+    Instance.Evaluated.Valid = true;
+    Instance.Evaluated.TimeInSeconds = Instance.TimeInSeconds;
+    Instance.Evaluated.StartAnimIndex = Instance.StartAnimIndex;
+    Instance.Evaluated.EndAnimIndex = Instance.EndAnimIndex;
+    Instance.Evaluated.BlendFactor = Instance.BlendFactor;
+    Instance.Evaluated.Blend = Instance.Blend;
+    Instance.Evaluated.SkipDetailBones = SkipDetailBones;
+    Instance.Evaluated.DualQuaternion = m_SkinningMode == SkinningMode::DualQuaternion;
+}
+
+// True when evaluating the instance again would give the palette it already holds
+static bool IsPoseCurrent(const AnimationInstance& Instance, bool SkipDetailBones, bool DualQuaternion) {
+    const auto& Evaluated = Instance.Evaluated;
+    return Evaluated.Valid && Evaluated.TimeInSeconds == Instance.TimeInSeconds &&
+           Evaluated.StartAnimIndex == Instance.StartAnimIndex && Evaluated.EndAnimIndex == Instance.EndAnimIndex &&
+           Evaluated.BlendFactor == Instance.BlendFactor && Evaluated.Blend == Instance.Blend &&
+           Evaluated.SkipDetailBones == SkipDetailBones && Evaluated.DualQuaternion == DualQuaternion;
+}
+
+uint SkinnedMesh::CreateInstance(const glm::mat4& World, uint AnimationIndex) {
+    if (AnimationIndex >= NumAnimations()) {
+        printf("Invalid animation index %d, max is %d\n", AnimationIndex, NumAnimations());
+        assert(0);
     }
+
+    AnimationInstance Instance;
+    Instance.World = World;
+    Instance.StartAnimIndex = AnimationIndex;
+    Instance.EndAnimIndex = AnimationIndex;
+    Instance.BoneTransforms.resize(m_BoneOffsets.size(), AffineMatrix(0.0f));
+    m_Instances.push_back(std::move(Instance));
+    return (uint)m_Instances.size() - 1;
 }
 
+uint SkinnedMesh::UpdateInstances(double DeltaSeconds, const glm::vec3& CameraPos, gl::JobSystem& Jobs) {
+    if (m_Instances.empty() || m_Clips.empty()) return 0;
+
+    if (m_WorkerScratch.size() != Jobs.NumThreads()) {
+        m_WorkerScratch.resize(Jobs.NumThreads());
+        for (auto& Scratch : m_WorkerScratch) InitScratch(Scratch);
+    }
+
+    // Any worker may pick up the largest blend, size them all for it now rather than on first use
+    uint NumBlendPoses = 2;
+    for (const AnimationInstance& Instance : m_Instances) {
+        NumBlendPoses = max(NumBlendPoses, (uint)(Instance.Blend.Inputs.size() + Instance.Blend.Layers.size()));
+    }
+    for (auto& Scratch : m_WorkerScratch) ReserveBlendScratch(Scratch, NumBlendPoses);
+
+    uint UpdateIndex = m_UpdateCount++;
+    std::atomic<uint> NumEvaluated{0};
+
+    bool DualQuaternion = m_SkinningMode == SkinningMode::DualQuaternion;
+    uint NumInstances = (uint)m_Instances.size();
+    CrowdFrame& Frame = m_CrowdFrames.GetWriteBuffer();
+    Frame.Worlds.resize(NumInstances);
+    Frame.Palettes.resize(NumInstances);
+    Frame.DualQuats.resize(DualQuaternion ? NumInstances : 0);
+    Frame.DualQuaternion = DualQuaternion;
+
+    // A few characters per batch keeps the atomic traffic low without starving threads on small crowds
+    constexpr uint INSTANCES_PER_BATCH = 4;
+    Jobs.ParallelFor((uint)m_Instances.size(), INSTANCES_PER_BATCH, [&](uint Begin, uint End, uint Worker) {
+        PoseScratch& Scratch = m_WorkerScratch[Worker];
+        uint Evaluated = 0;
+
+        for (uint i = Begin ; i < End ; i++) {
+            AnimationInstance& Instance = m_Instances[i];
+            Instance.TimeInSeconds += DeltaSeconds * Instance.PlaybackSpeed;
+
+            float Distance = glm::length(glm::vec3(Instance.World[3]) - CameraPos);
+            uint Level = 0;
+            while (Level + 1 < m_LODs.size() && Distance >= m_LODs[Level + 1].MinDistance) Level++;
+
+            // Instances on the same interval are phased by index so each update evaluates an even
+            // share of them instead of all of them every Nth update. Moving to a finer level
+            // evaluates at once rather than holding a coarse pose for the rest of the old interval.
+            const AnimationLOD& LOD = m_LODs[Level];
+            bool Refine = Level < Instance.LODLevel;
+            Instance.LODLevel = Level;
+            bool Due = Refine || LOD.UpdateInterval <= 1 || (UpdateIndex + i) % LOD.UpdateInterval == 0;
+            if (Due && !IsPoseCurrent(Instance, LOD.SkipDetailBones, DualQuaternion)) {
+                EvaluateInstance(Instance, LOD.SkipDetailBones, Scratch);
+                Evaluated++;
+            }
+
+            // Held palettes are copied too, the slot holds a frame from two updates ago
+            Frame.Worlds[i] = Instance.World;
+            Frame.Palettes[i] = Instance.BoneTransforms;
+            if (DualQuaternion) Frame.DualQuats[i] = Instance.DualQuats;
+        }
 
-void SkinnedMesh::ReadNodeHierarchy(float AnimationTimeTicks, const aiNode* pNode,
-                                    const glm::mat4& ParentTransform, const aiAnimation& Animation) {
+        NumEvaluated.fetch_add(Evaluated, std::memory_order_relaxed);
+    });
 
-    string NodeName(pNode->mName.data);
-    glm::mat4 NodeTransformation(AiToGlmMat4(pNode->mTransformation));
-    const aiNodeAnim* pNodeAnim = FindNodeAnim(Animation, NodeName);
+    m_CrowdFrames.Publish();
+    return NumEvaluated.load(std::memory_order_relaxed);
+}
+
+void SkinnedMesh::GetBoneTransforms(double TimeInSeconds, vector<AffineMatrix>& Transforms, unsigned int AnimationIndex) {
+    UpdateBoneTransforms(TimeInSeconds, AnimationIndex);
+    Transforms = m_BoneTransforms;
+}
+
+void SkinnedMesh::GetBoneTransformsBlended(double TimeInSeconds, vector<AffineMatrix>& BlendedTransforms,
+                                           unsigned int StartAnimIndex, unsigned int EndAnimIndex, float BlendFactor) {
+    UpdateBoneTransformsBlended(TimeInSeconds, StartAnimIndex, EndAnimIndex, BlendFactor);
+    BlendedTransforms = m_BoneTransforms;
+}
 
-    if (pNodeAnim) {
-        LocalTransform Transform;
-        CalcLocalTransform(Transform, AnimationTimeTicks, pNodeAnim);
-        glm::mat4 ScalingM = glm::scale(glm::mat4(1.0f), AiToGlmVec3(Transform.Scaling));
-        glm::mat4 RotationM = glm::mat4(AiToGlmMat3(Transform.Rotation.GetMatrix()));
-        glm::mat4 TranslationM = glm::translate(glm::mat4(1.0f), AiToGlmVec3(Transform.Translation));
+void SkinnedMesh::UpdateBoneTransforms(double TimeInSeconds, uint AnimationIndex) {
 
-        NodeTransformation = TranslationM * RotationM * ScalingM;
+    if (AnimationIndex >= NumAnimations()) {
+        printf("Invalid animation index %d, max is %d\n", AnimationIndex, NumAnimations());
+        assert(0);
     }
 
-    glm::mat4 GlobalTransformation = ParentTransform * NodeTransformation;
+    float AnimationTimeTicks = CalcAnimationTimeTicks(TimeInSeconds, AnimationIndex);
+    EvaluateSkeleton(AnimationTimeTicks, AnimationIndex, false, m_Scratch, m_BoneTransforms.data(),
+                     m_PaletteClip == (int)AnimationIndex);
+    m_PaletteClip = (int)AnimationIndex;
+}
+
+void SkinnedMesh::UpdateBoneTransformsBlended(double TimeInSeconds, uint StartAnimIndex, uint EndAnimIndex,
+                                              float BlendFactor) {
 
-    if (m_BoneNameToIndexMap.contains(NodeName)) {
-        uint BoneIndex = m_BoneNameToIndexMap[NodeName];
-        m_BoneInfo[BoneIndex].FinalTransformation = m_GlobalInverseTransform *
-                GlobalTransformation * m_BoneInfo[BoneIndex].OffsetMatrix;
+    if (StartAnimIndex >= NumAnimations()) {
+        printf("Invalid start animation index %d, max is %d\n", StartAnimIndex, NumAnimations());
+        assert(0);
     }
 
-    for (uint i = 0 ; i < pNode->mNumChildren ; i++) {
-        string ChildName(pNode->mChildren[i]->mName.data);
-        ReadNodeHierarchy(AnimationTimeTicks, pNode->mChildren[i], GlobalTransformation, Animation);
+    if (EndAnimIndex >= NumAnimations()) {
+        printf("Invalid end animation index %d, max is %d\n", EndAnimIndex, NumAnimations());
+        assert(0);
+    }
+
+    if ((BlendFactor < 0.0f) || (BlendFactor > 1.0f)) {
+        printf("Invalid blend factor %f\n", BlendFactor);
+        assert(0);
     }
+
+    BlendInput Inputs[2] = { { StartAnimIndex, 1.0f - BlendFactor }, { EndAnimIndex, BlendFactor } };
+    EvaluateBlend(TimeInSeconds, Inputs, 2, nullptr, 0, false, m_Scratch, m_BoneTransforms.data());
+    m_PaletteClip = -1;
 }
 
-void SkinnedMesh::ReadNodeHierarchyBlended(float StartAnimationTimeTicks, float EndAnimationTimeTicks,
-                                           const aiNode* pNode, const glm::mat4& ParentTransform,
-                                           const aiAnimation& StartAnimation, const aiAnimation& EndAnimation,
-                                           float BlendFactor) {
+void SkinnedMesh::GetBoneTransformsBlended(double TimeInSeconds, vector<AffineMatrix>& BlendedTransforms,
+                                           const BlendTree& Tree) {
+
+    for (const BlendInput& Input : Tree.Inputs) {
+        if (Input.AnimationIndex >= NumAnimations()) {
+            printf("Invalid blend input animation index %d, max is %d\n", Input.AnimationIndex, NumAnimations());
+            assert(0);
+        }
+    }
+
+    for (const BlendLayer& Layer : Tree.Layers) {
+        if (Layer.AnimationIndex >= NumAnimations() || Layer.Mask >= (int)m_BoneMasks.size()) {
+            printf("Invalid blend layer, animation index %d mask %d\n", Layer.AnimationIndex, Layer.Mask);
+            assert(0);
+        }
+    }
+
+    EvaluateBlend(TimeInSeconds, Tree.Inputs.data(), (uint)Tree.Inputs.size(), Tree.Layers.data(),
+                  (uint)Tree.Layers.size(), false, m_Scratch, m_BoneTransforms.data());
+    m_PaletteClip = -1;
 
-    string NodeName(pNode->mName.data);
-    glm::mat4 NodeTransformation(AiToGlmMat4(pNode->mTransformation));
-    const aiNodeAnim* pStartNodeAnim = FindNodeAnim(StartAnimation, NodeName);
-    LocalTransform StartTransform;
+    BlendedTransforms = m_BoneTransforms;
+}
 
-    if (pStartNodeAnim) {
-        CalcLocalTransform(StartTransform, StartAnimationTimeTicks, pStartNodeAnim);
+int SkinnedMesh::CreateBoneMask(const vector<string>& RootNodeNames) {
+    vector<bool> RootNames(m_Skeleton.NodeNames.Size(), false);
+    bool Found = false;
+    for (const string& Name : RootNodeNames) {
+        int NameID = m_Skeleton.NodeNames.Find(Name);
+        if (NameID < 0) continue;
+        RootNames[NameID] = true;
+        Found = true;
     }
 
-    LocalTransform EndTransform;
-    const aiNodeAnim* pEndNodeAnim = FindNodeAnim(EndAnimation, NodeName);
+    if (!Found) {
+        printf("None of the %zu bone mask roots is in the skeleton\n", RootNodeNames.size());
+        return -1;
+    }
 
-    if ((pStartNodeAnim && !pEndNodeAnim) || (!pStartNodeAnim && pEndNodeAnim)) {
-        printf("On the node %s there is an animation node for only one of the start/end animations.\n", NodeName.c_str());
-        printf("This case is not supported\n");
-        exit(0);
+    // Parents precede their children, so a subtree is covered in one forward pass
+    uint NumNodes = m_Skeleton.NumNodes();
+    vector<float> Mask(NumNodes, 0.0f);
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        int Parent = m_Skeleton.Parents[i];
+        Mask[i] = RootNames[m_Skeleton.NameIDs[i]] || (Parent >= 0 && Mask[Parent] > 0.0f) ? 1.0f : 0.0f;
     }
 
-    if (pEndNodeAnim) {
-        CalcLocalTransform(EndTransform, EndAnimationTimeTicks, pEndNodeAnim);
+    m_BoneMasks.push_back(std::move(Mask));
+    return (int)m_BoneMasks.size() - 1;
+}
+
+float SkinnedMesh::CalcAnimationTimeTicks(double TimeInSeconds, unsigned int AnimationIndex) const {
+    const AnimationClip& Clip = *m_Clips[AnimationIndex];
+    // Wrapped in double, a float playhead loses whole frames of precision after a few hours
+    double TimeInTicks = TimeInSeconds * (double)Clip.TicksPerSecond();
+    double Duration = floor((double)Clip.DurationTicks());
+    double AnimationTimeTicks = fmod(TimeInTicks, Duration);
+    if (AnimationTimeTicks < 0.0) AnimationTimeTicks += Duration;
+    return (float)AnimationTimeTicks;
+}
+
+void SkinnedMesh::InitSkeleton(const aiScene* paiScene) {
+    vector<const aiNode*> Nodes;
+    vector<int> Parents;
+    FlattenNode(paiScene->mRootNode, -1, Nodes, Parents);
+    uint NumNodes = (uint)Nodes.size();
+
+    // Move detail subtrees behind every core node. Both runs stay depth-first, and a detail
+    // node's parent is either a core node or an earlier detail node, so parents still come first.
+    vector<bool> Detail(NumNodes, false);
+    vector<uint> Order;
+    Order.reserve(NumNodes);
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        Detail[i] = Parents[i] >= 0 && (Detail[Parents[i]] || IsDetailBone(Nodes[i]->mName.data));
+        if (!Detail[i]) Order.push_back(i);
+    }
+    uint NumCoreNodes = (uint)Order.size();
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        if (Detail[i]) Order.push_back(i);
     }
 
-    if (pStartNodeAnim && pEndNodeAnim) {
-        // Interpolate scaling
-        const aiVector3D& Scale0 = StartTransform.Scaling;
-        const aiVector3D& Scale1 = EndTransform.Scaling;
-        aiVector3D BlendedScaling = (1.0f - BlendFactor) * Scale0 + Scale1 * BlendFactor;
-        glm::mat4 ScalingM = glm::scale(glm::mat4(1.0f), AiToGlmVec3(BlendedScaling));
+    vector<int> NewIndex(NumNodes);
+    for (uint i = 0 ; i < NumNodes ; i++) NewIndex[Order[i]] = (int)i;
 
-        // Interpolate rotation
-        const aiQuaternion& Rot0 = StartTransform.Rotation;
-        const aiQuaternion& Rot1 = EndTransform.Rotation;
-        aiQuaternion BlendedRot;
-        aiQuaternion::Interpolate(BlendedRot, Rot0, Rot1, BlendFactor);
-        glm::mat4 RotationM = glm::mat4(AiToGlmMat3(BlendedRot.GetMatrix()));
+    m_Skeleton = Skeleton();
+    m_Skeleton.NumCoreNodes = NumCoreNodes;
+    m_Skeleton.BindLocals.Resize(NumNodes);
+    m_Skeleton.NameIDs.resize(NumNodes);
 
-        // Interpolate translation
-        const aiVector3D& Pos0 = StartTransform.Translation;
-        const aiVector3D& Pos1 = EndTransform.Translation;
-        aiVector3D BlendedTranslation = (1.0f - BlendFactor) * Pos0 + Pos1 * BlendFactor;
-        glm::mat4 TranslationM = glm::translate(glm::mat4(1.0f), AiToGlmVec3(BlendedTranslation));
-        NodeTransformation = TranslationM * RotationM * ScalingM;
+    // Interned in depth-first order so the first node wins on duplicate names, as before the reorder
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        const aiString& Name = Nodes[i]->mName;
+        uint NameID = m_Skeleton.NodeNames.Intern(Name.data, Name.length);
+        if (NameID == m_Skeleton.NamedNodes.size()) m_Skeleton.NamedNodes.push_back(NewIndex[i]);
+        m_Skeleton.NameIDs[NewIndex[i]] = NameID;
     }
 
-    glm::mat4 GlobalTransformation = ParentTransform * NodeTransformation;
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        const aiNode* pNode = Nodes[Order[i]];
 
-    if (m_BoneNameToIndexMap.contains(NodeName)) {
-        uint BoneIndex = m_BoneNameToIndexMap[NodeName];
-        m_BoneInfo[BoneIndex].FinalTransformation = m_GlobalInverseTransform *
-                                                    GlobalTransformation *
-                                                    m_BoneInfo[BoneIndex].OffsetMatrix;
+        aiVector3D Scaling, Translation;
+        aiQuaternion Rotation;
+        pNode->mTransformation.Decompose(Scaling, Rotation, Translation);
+
+        int Parent = Parents[Order[i]];
+        m_Skeleton.Parents.push_back(Parent >= 0 ? NewIndex[Parent] : -1);
+        m_Skeleton.BindLocals.Set(i, AiToGlmVec3(Translation), AiToGlmQuat(Rotation), AiToGlmVec3(Scaling));
+        m_Skeleton.BoneSlots.push_back(m_BoneNames.Find(pNode->mName.data, pNode->mName.length));
     }
 
-    for (uint i = 0 ; i < pNode->mNumChildren ; i++) {
-        string ChildName(pNode->mChildren[i]->mName.data);
-        ReadNodeHierarchyBlended(StartAnimationTimeTicks, EndAnimationTimeTicks,
-                                 pNode->mChildren[i], GlobalTransformation, StartAnimation,
-                                 EndAnimation, BlendFactor);
+    for (uint i = NumCoreNodes ; i < NumNodes ; i++) {
+        glm::mat4 FromAnchor = AiToGlmMat4(Nodes[Order[i]]->mTransformation);
+        int Anchor = m_Skeleton.Parents[i];
+        while (Anchor >= (int)NumCoreNodes) {
+            FromAnchor = AiToGlmMat4(Nodes[Order[Anchor]]->mTransformation) * FromAnchor;
+            Anchor = m_Skeleton.Parents[Anchor];
+        }
+        m_Skeleton.DetailAnchors.push_back(Anchor);
+        m_Skeleton.DetailFromAnchor.push_back(FromAnchor);
+    }
+
+    // Later nodes win when several share a bone name, matching the order the palette used to be written in
+    m_Skeleton.BoneNodes.assign(m_BoneOffsets.size(), -1);
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        int Slot = m_Skeleton.BoneSlots[NewIndex[i]];
+        if (Slot >= 0) m_Skeleton.BoneNodes[Slot] = NewIndex[i];
     }
-}
 
-void SkinnedMesh::CalcLocalTransform(LocalTransform& Transform, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) {
-    CalcInterpolatedScaling(Transform.Scaling, AnimationTimeTicks, pNodeAnim);
-    CalcInterpolatedRotation(Transform.Rotation, AnimationTimeTicks, pNodeAnim);
-    CalcInterpolatedPosition(Transform.Translation, AnimationTimeTicks, pNodeAnim);
+    InitScratch(m_Scratch);
+    m_WorkerScratch.clear();
+    m_BoneMasks.clear();
+    vector<vector<uint>> TrackChannels;
+    InitTrackTable(paiScene, TrackChannels);
+    BakeClips(paiScene, TrackChannels);
 }
 
-void SkinnedMesh::GetBoneTransforms(float TimeInSeconds, vector<glm::mat4>& Transforms, unsigned int AnimationIndex) {
+void SkinnedMesh::FlattenNode(const aiNode* pNode, int Parent, vector<const aiNode*>& Nodes, vector<int>& Parents) {
+    int Index = (int)Nodes.size();
+    Nodes.push_back(pNode);
+    Parents.push_back(Parent);
 
-    if (AnimationIndex >= pScene->mNumAnimations) {
-        printf("Invalid animation index %d, max is %d\n", AnimationIndex, pScene->mNumAnimations);
-        assert(0);
+    for (uint i = 0 ; i < pNode->mNumChildren ; i++) {
+        FlattenNode(pNode->mChildren[i], Index, Nodes, Parents);
     }
+}
 
-    auto Identity = glm::mat4(1.0f);
+bool SkinnedMesh::IsDetailBone(const string& NodeName) const {
+    for (const string& Pattern : m_DetailBonePatterns) {
+        if (NodeName.find(Pattern) != string::npos) return true;
+    }
+    return false;
+}
 
-    float AnimationTimeTicks = CalcAnimationTimeTicks(TimeInSeconds, AnimationIndex);
-    const aiAnimation& Animation = *pScene->mAnimations[AnimationIndex];
-    ReadNodeHierarchy(AnimationTimeTicks, pScene->mRootNode, Identity, Animation);
-    Transforms.resize(m_BoneInfo.size());
+void SkinnedMesh::InitTrackTable(const aiScene* paiScene, vector<vector<uint>>& TrackChannels) {
+    uint NumNodes = m_Skeleton.NumNodes();
+    m_NodeTracks.assign((size_t)paiScene->mNumAnimations * NumNodes, -1);
+    m_NumCoreTracks.assign(paiScene->mNumAnimations, 0);
+    TrackChannels.assign(paiScene->mNumAnimations, {});
+    vector<int> NodeChannels(NumNodes);
+
+    for (uint a = 0 ; a < paiScene->mNumAnimations ; a++) {
+        const aiAnimation* pAnimation = paiScene->mAnimations[a];
+        fill(NodeChannels.begin(), NodeChannels.end(), -1);
+        // Walk backwards so the first channel wins on duplicate names, as the old linear scan did
+        for (int c = (int)pAnimation->mNumChannels - 1 ; c >= 0 ; c--) {
+            const aiString& Name = pAnimation->mChannels[c]->mNodeName;
+            int NameID = m_Skeleton.NodeNames.Find(Name.data, Name.length);
+            if (NameID >= 0) {
+                NodeChannels[m_Skeleton.NamedNodes[NameID]] = c;
+            }
+        }
 
-    for (uint i = 0 ; i < m_BoneInfo.size() ; i++) {
-        Transforms[i] = m_BoneInfo[i].FinalTransformation;
+        // Tracks follow node order, so the core nodes' tracks are a prefix a reduced LOD samples alone
+        for (uint i = 0 ; i < NumNodes ; i++) {
+            if (NodeChannels[i] < 0) continue;
+            m_NodeTracks[(size_t)a * NumNodes + i] = (int)TrackChannels[a].size();
+            TrackChannels[a].push_back((uint)NodeChannels[i]);
+            if (i < m_Skeleton.NumCoreNodes) m_NumCoreTracks[a]++;
+        }
     }
 }
 
-void SkinnedMesh::GetBoneTransformsBlended(float TimeInSeconds, vector<glm::mat4>& BlendedTransforms,
-                                           unsigned int StartAnimIndex, unsigned int EndAnimIndex, float BlendFactor) {
+void SkinnedMesh::BakeClips(const aiScene* paiScene, const vector<vector<uint>>& TrackChannels) {
+    m_Clips.clear();
+    m_ClipNodes.assign(paiScene->mNumAnimations, ClipNodes());
+    m_NumStaticBones = 0;
+    m_PaletteClip = -1;
+    vector<bool> ConstantTracks, StaticNodes;
+
+    for (uint a = 0 ; a < paiScene->mNumAnimations ; a++) {
+        const aiAnimation* pAnimation = paiScene->mAnimations[a];
+        float TicksPerSecond = (float)(pAnimation->mTicksPerSecond != 0 ? pAnimation->mTicksPerSecond : 25.0f);
+        float DurationSec = (float)pAnimation->mDuration / TicksPerSecond;
+
+        // Resample at the default rate, or at the clip's densest key rate if that is finer
+        float SampleRate = ANIMATION_SAMPLE_RATE;
+        for (uint c = 0 ; c < pAnimation->mNumChannels && DurationSec > 0.0f ; c++) {
+            const aiNodeAnim* pNodeAnim = pAnimation->mChannels[c];
+            uint MaxKeys = max({pNodeAnim->mNumPositionKeys, pNodeAnim->mNumRotationKeys, pNodeAnim->mNumScalingKeys});
+            SampleRate = max(SampleRate, (float)(MaxKeys - 1) / DurationSec);
+        }
+        SampleRate = min(SampleRate, ANIMATION_MAX_SAMPLE_RATE);
+
+        auto pClip = make_unique<BakedClip>();
+        BakedClip& Clip = *pClip;
+        const vector<uint>& Channels = TrackChannels[a];
+        Clip.Init((uint)Channels.size(), (float)pAnimation->mDuration, TicksPerSecond, SampleRate);
+        size_t SourceBytes = 0;
+
+        for (uint t = 0 ; t < Channels.size() ; t++) {
+            const aiNodeAnim* pNodeAnim = pAnimation->mChannels[Channels[t]];
+            KeyCursor Cursor;
+            SourceBytes += pNodeAnim->mNumPositionKeys * sizeof(aiVectorKey) +
+                           pNodeAnim->mNumRotationKeys * sizeof(aiQuatKey) +
+                           pNodeAnim->mNumScalingKeys * sizeof(aiVectorKey);
+
+            for (uint f = 0 ; f < Clip.NumFrames() ; f++) {
+                LocalTransform Transform;
+                CalcLocalTransform(Transform, Clip.GetFrameTimeTicks(f), pNodeAnim, Cursor);
+                Clip.SetKey(f, t, AiToGlmVec3(Transform.Translation), AiToGlmQuat(Transform.Rotation),
+                            AiToGlmVec3(Transform.Scaling));
+            }
+        }
 
-    if (StartAnimIndex >= pScene->mNumAnimations) {
-        printf("Invalid start animation index %d, max is %d\n", StartAnimIndex, pScene->mNumAnimations);
-        assert(0);
+        // Found on the exact keys, compression only moves a constant track within its error bounds
+        ConstantTracks.assign(Channels.size(), true);
+        for (uint t = 0 ; t < Channels.size() ; t++) {
+            for (uint f = 1 ; f < Clip.NumFrames() && ConstantTracks[t] ; f++) {
+                ConstantTracks[t] = Clip.GetTranslation(f, t) == Clip.GetTranslation(0, t) &&
+                                    Clip.GetRotation(f, t) == Clip.GetRotation(0, t) &&
+                                    Clip.GetScale(f, t) == Clip.GetScale(0, t);
+            }
+        }
+        FindStaticNodes(a, ConstantTracks, StaticNodes);
+        ReorderStaticTracks(a, StaticNodes, Clip);
+
+        unique_ptr<AnimationClip> pFinal = std::move(pClip);
+        if (m_MaxPositionError > 0.0f || m_MaxRotationError > 0.0f) {
+            auto pCompressed = make_unique<CompressedClip>();
+            if (pCompressed->Compress(Clip, m_MaxPositionError, m_MaxRotationError)) {
+                printf("Animation %d: %zu bytes of keys, %zu baked, %zu compressed (%.1fx)\n", a, SourceBytes,
+                       Clip.MemoryBytes(), pCompressed->MemoryBytes(),
+                       (double)SourceBytes / (double)max<size_t>(pCompressed->MemoryBytes(), 1));
+                pFinal = std::move(pCompressed);
+            } else {
+                printf("Animation %d: %u frames, too long to compress, kept baked\n", a, Clip.NumFrames());
+            }
+        }
+        m_Clips.push_back(std::move(pFinal));
+        InitClipNodes(a, StaticNodes);
     }
 
-    if (EndAnimIndex >= pScene->mNumAnimations) {
-        printf("Invalid end animation index %d, max is %d\n", EndAnimIndex, pScene->mNumAnimations);
-        assert(0);
+    m_ReferencePoses.resize(m_Clips.size());
+    for (uint a = 0 ; a < m_Clips.size() ; a++) {
+        m_Clips[a]->SamplePose(0.0f, m_ReferencePoses[a], m_Clips[a]->NumTracks());
     }
 
-    if ((BlendFactor < 0.0f) || (BlendFactor > 1.0f)) {
-        printf("Invalid blend factor %f\n", BlendFactor);
-        assert(0);
+    if (m_NumStaticBones > 0) {
+        printf("%u of %zu clip bones are static\n", m_NumStaticBones, m_BoneOffsets.size() * m_Clips.size());
     }
 
-    float StartAnimationTimeTicks = CalcAnimationTimeTicks(TimeInSeconds, StartAnimIndex);
-    float EndAnimationTimeTicks = CalcAnimationTimeTicks(TimeInSeconds, EndAnimIndex);
+    BuildPoseCache();
+}
 
-    const aiAnimation& StartAnimation = *pScene->mAnimations[StartAnimIndex];
-    const aiAnimation& EndAnimation = *pScene->mAnimations[EndAnimIndex];
+void SkinnedMesh::FindStaticNodes(uint AnimationIndex, const vector<bool>& ConstantTracks, vector<bool>& StaticNodes) {
+    // Parents come before their children. Detail nodes are left out, reduced LODs move them with
+    // their anchor instead of their tracks.
+    StaticNodes.assign(m_Skeleton.NumNodes(), false);
+    for (uint i = 0 ; i < m_Skeleton.NumCoreNodes ; i++) {
+        int Track = GetTrack(AnimationIndex, i);
+        int Parent = m_Skeleton.Parents[i];
+        StaticNodes[i] = (Track < 0 || ConstantTracks[Track]) && (Parent < 0 || StaticNodes[Parent]);
+    }
+}
 
-    glm::mat4 Identity = glm::mat4(1.0f);
-    ReadNodeHierarchyBlended(StartAnimationTimeTicks, EndAnimationTimeTicks,
-                             pScene->mRootNode, Identity, StartAnimation, EndAnimation, BlendFactor);
+void SkinnedMesh::ReorderStaticTracks(uint AnimationIndex, const vector<bool>& StaticNodes, BakedClip& Clip) {
+    uint NumNodes = m_Skeleton.NumNodes();
+    int* pNodeTracks = &m_NodeTracks[(size_t)AnimationIndex * NumNodes];
+
+    // Dynamic core tracks, then static core tracks, then detail tracks, so both the core tracks
+    // and the dynamic ones stay a leading run
+    vector<uint> Order;
+    Order.reserve(Clip.NumTracks());
+    for (bool Static : { false, true }) {
+        for (uint i = 0 ; i < m_Skeleton.NumCoreNodes ; i++) {
+            if (pNodeTracks[i] >= 0 && StaticNodes[i] == Static) Order.push_back((uint)pNodeTracks[i]);
+        }
+    }
+    for (uint i = m_Skeleton.NumCoreNodes ; i < NumNodes ; i++) {
+        if (pNodeTracks[i] >= 0) Order.push_back((uint)pNodeTracks[i]);
+    }
+    assert(Order.size() == Clip.NumTracks());
 
-    BlendedTransforms.resize(m_BoneInfo.size());
-    for (uint i = 0 ; i < m_BoneInfo.size() ; i++) {
-        BlendedTransforms[i] = m_BoneInfo[i].FinalTransformation;
+    vector<int> NewTracks(Order.size());
+    for (uint t = 0 ; t < Order.size() ; t++) NewTracks[Order[t]] = (int)t;
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        if (pNodeTracks[i] >= 0) pNodeTracks[i] = NewTracks[pNodeTracks[i]];
     }
+    Clip.ReorderTracks(Order);
 }
 
-float SkinnedMesh::CalcAnimationTimeTicks(float TimeInSeconds, unsigned int AnimationIndex) {
-    float TicksPerSecond = (float)(pScene->mAnimations[AnimationIndex]->mTicksPerSecond != 0 ?
-            pScene->mAnimations[AnimationIndex]->mTicksPerSecond : 25.0f);
-    float TimeInTicks = TimeInSeconds * TicksPerSecond;
-    float Duration = 0.0f;
-    float fraction = modf((float)pScene->mAnimations[AnimationIndex]->mDuration, &Duration);
-    float AnimationTimeTicks = fmod(TimeInTicks, Duration);
-    return AnimationTimeTicks;
-}
+void SkinnedMesh::InitClipNodes(uint AnimationIndex, const vector<bool>& StaticNodes) {
+    uint NumNodes = m_Skeleton.NumNodes();
+    uint NumBones = (uint)m_BoneOffsets.size();
+
+    // The clip's first frame over the whole skeleton, static nodes hold it throughout
+    vector<AffineMatrix> Palette(NumBones, AffineMatrix(0.0f));
+    m_Clips[AnimationIndex]->SamplePose(0.0f, m_Scratch.Pose, m_Clips[AnimationIndex]->NumTracks());
+    m_Scratch.LocalTRS = m_Skeleton.BindLocals;
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        int Track = GetTrack(AnimationIndex, i);
+        if (Track >= 0) {
+            m_Scratch.LocalTRS.Set(i, m_Scratch.Pose.Translations[Track], m_Scratch.Pose.Rotations[Track],
+                                   m_Scratch.Pose.Scales[Track]);
+        }
+    }
+    UpdatePalette(NumNodes, m_Scratch, m_Skeleton.BoneNodes.data(), Palette.data());
+    const vector<glm::mat4>& Globals = m_Scratch.GlobalTransforms;
+
+    ClipNodes& Clip = m_ClipNodes[AnimationIndex];
+    vector<int> Compact(NumNodes, -1);
+    for (uint i = 0 ; i < NumNodes ; i++) {
+        if (StaticNodes[i]) continue;
+
+        uint k = (uint)Clip.Nodes.size();
+        int Parent = m_Skeleton.Parents[i];
+        Compact[i] = (int)k;
+        Clip.Nodes.push_back((int)i);
+        Clip.Parents.push_back(Parent >= 0 ? Compact[Parent] : -1);
+        if (Parent >= 0 && StaticNodes[Parent]) {
+            Clip.AttachedNodes.push_back(k);
+            Clip.AttachGlobals.push_back(Globals[Parent]);
+        }
+        if (i < m_Skeleton.NumCoreNodes) {
+            Clip.NumCoreNodes++;
+            if (GetTrack(AnimationIndex, i) >= 0) Clip.NumDynamicTracks++;
+        }
+    }
+
+    const NodeTRS& Bind = m_Skeleton.BindLocals;
+    Clip.BindLocals.Resize((uint)Clip.Nodes.size());
+    for (uint k = 0 ; k < Clip.Nodes.size() ; k++) {
+        int i = Clip.Nodes[k];
+        Clip.BindLocals.Set(k, glm::vec3(Bind.Tx[i], Bind.Ty[i], Bind.Tz[i]),
+                            glm::quat(Bind.Qw[i], Bind.Qx[i], Bind.Qy[i], Bind.Qz[i]),
+                            glm::vec3(Bind.Sx[i], Bind.Sy[i], Bind.Sz[i]));
+    }
 
-const aiNodeAnim* SkinnedMesh::FindNodeAnim(const aiAnimation& pAnimation, const string& NodeName) {
-    for (uint i = 0 ; i < pAnimation.mNumChannels ; i++) {
+    // Detail nodes are never static, so they keep their order and their index past NumCoreNodes
+    for (uint Detail = 0 ; Detail < m_Skeleton.DetailAnchors.size() ; Detail++) {
+        int Anchor = m_Skeleton.DetailAnchors[Detail];
+        const glm::mat4& FromAnchor = m_Skeleton.DetailFromAnchor[Detail];
+        Clip.DetailAnchors.push_back(StaticNodes[Anchor] ? -1 : Compact[Anchor]);
+        Clip.DetailFromAnchor.push_back(StaticNodes[Anchor] ? Globals[Anchor] * FromAnchor : FromAnchor);
+    }
 
-        const aiNodeAnim* pNodeAnim = pAnimation.mChannels[i];
-        if (string(pNodeAnim->mNodeName.data) == NodeName) {
-            return pNodeAnim;
+    Clip.BoneNodes.assign(NumBones, -1);
+    for (uint b = 0 ; b < NumBones ; b++) {
+        int Node = m_Skeleton.BoneNodes[b];
+        if (Node < 0) continue;
+        if (StaticNodes[Node]) {
+            Clip.StaticBones.push_back(b);
+            Clip.StaticPalette.push_back(Palette[b]);
+        } else {
+            Clip.BoneNodes[b] = Compact[Node];
         }
     }
-    return nullptr;
-}
\ No newline at end of file
+    m_NumStaticBones += (uint)Clip.StaticBones.size();
+}
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <map>
+#include <cstdint>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <GL/glew.h>
 #include <cassert>
@@ -8,6 +10,14 @@
 #include <assimp/scene.h>       // Output data structure
 #include <assimp/postprocess.h> // Post processing flags
 #include <glm/glm.hpp>
+#include "compressedClip.h"
+#include "blendTree.h"
+#include "nameTable.h"
+#include "animationClock.h"
+#include "boneKernels.h"
+#include "../jobSystem.h"
+#include "../tripleBuffer.h"
+#include "../streamBuffer.h"
 // #include "worldTransform.h"
 
 #ifdef _WIN32
@@ -16,7 +26,15 @@
 #define SNPRINTF snprintf
 #endif
 
-#define MAX_BONES 200
+// Bones one draw's palette holds, the size of the shaders' BonePalette block. Skeletons may have
+// any number of bones, meshes whose triangles reference more are split into partitions at load.
+#define MAX_BONES 64
+// Uniform block binding of the BonePalette block, and storage buffer binding of the compute palette
+#define PALETTE_BLOCK_BINDING 0
+#define PALETTE_STORAGE_BINDING 2
+// Texture units of the palette and world matrix buffer textures the instanced crowd programs read
+#define PALETTE_TEXTURE_UNIT 9
+#define INSTANCE_WORLD_TEXTURE_UNIT 10
 
 #define ASSIMP_LOAD_FLAGS (aiProcess_JoinIdenticalVertices |    \
                            aiProcess_Triangulate |              \
@@ -52,12 +70,71 @@ public:
 };
 
 
+// One character driven by a SkinnedMesh. Instances share the mesh's skeleton, clips and GPU
+// buffers, and only carry their own playback state and bone palette.
+struct AnimationInstance {
+    glm::mat4 World = glm::mat4(1.0f);
+    unsigned int StartAnimIndex = 0;
+    unsigned int EndAnimIndex = 0;
+    float BlendFactor = 0.0f;       // 0 plays StartAnimIndex alone
+    double TimeInSeconds = 0.0;     // playhead, each clip loops on its own duration
+    float PlaybackSpeed = 1.0f;
+    unsigned int LODLevel = ~0u;    // picked by SkinnedMesh::UpdateInstances, ~0u until the first one
+    BlendTree Blend;                // replaces the start/end pair above when it has inputs
+    std::vector<AffineMatrix> BoneTransforms;
+    std::vector<glm::mat2x4> DualQuats;  // same palette, only kept up to date in SkinningMode::DualQuaternion
+    int PaletteClip = -1;           // clip whose static bones BoneTransforms holds, -1 after a blend
+    // What BoneTransforms was last evaluated from. UpdateInstances does not evaluate an instance
+    // again while its playhead and all of these stay the same, so a paused one keeps its palette.
+    struct {
+        bool Valid = false;
+        double TimeInSeconds = 0.0;
+        unsigned int StartAnimIndex = 0;
+        unsigned int EndAnimIndex = 0;
+        float BlendFactor = 0.0f;
+        BlendTree Blend;
+        bool SkipDetailBones = false;
+        bool DualQuaternion = false;
+    } Evaluated;
+};
+
+// One animation level of detail for crowd instances. An instance uses the last level whose
+// MinDistance it is beyond, measured from the camera to the origin of its world matrix.
+struct AnimationLOD {
+    float MinDistance = 0.0f;
+    unsigned int UpdateInterval = 1; // evaluate every Nth update, the palette is held in between
+    bool SkipDetailBones = false;    // detail bones follow their nearest animated ancestor rigidly
+};
+
+// How the vertex shader deforms the mesh. Linear blend skinning blends the bone matrices and
+// collapses volume at twisting joints. Dual quaternion skinning blends rigid transforms, which
+// keeps the volume and halves the palette, but it ignores any scale in the bone transforms.
+enum class SkinningMode {
+    LinearBlend,
+    DualQuaternion,
+};
+
+// One vertex skinned on the CPU, laid out like the skinning cache vertex buffer
+struct SkinnedPoint {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+};
+
+
 class SkinnedMesh {
 public:
     SkinnedMesh() {};
     ~SkinnedMesh();
 
     bool init();
+    // Compress clips at load with the given bounds (rotation in radians), 0 keeps them uncompressed
+    void SetClipCompression(float MaxPositionError, float MaxRotationError);
+    // Bakes the full palette of each clip over its loop at SampleRate poses per second, clip by
+    // clip while they fit in MaxBytes. Playing a cached clip is then one interpolation between two
+    // palettes at any LOD, blends still sample the clips. MaxBytes 0 turns the cache off. Must not
+    // be called while UpdateInstances runs.
+    void SetPoseCache(float SampleRate, size_t MaxBytes);
+    size_t GetPoseCacheBytes() const { return m_PoseCacheBytes; }
     bool LoadMesh(const std::string& Filename);
     void Render(const glm::mat4& model,
                 const glm::mat4& view,
@@ -67,23 +144,94 @@ public:
                 int endAnim,
                 float blendFactor);
 
-    uint NumBones() const { return (uint)m_BoneNameToIndexMap.size(); }
+    uint NumBones() const { return m_BoneNames.Size(); }
+    uint NumAnimations() const { return (uint)m_Clips.size(); }
     const Material& GetMaterial();
-    void GetBoneTransforms(float TimeInSeconds, std::vector<glm::mat4>& Transforms, unsigned int AnimationIndex);
-    void GetBoneTransformsBlended(float TimeInSeconds, std::vector<glm::mat4>& BlendedTransforms,
-                             unsigned int StartAnimIndex, unsigned int EndAnimIndex, float BlendFactor);
-
-    long long m_startTime = 0;
-    long long m_currentTime = 0;
-    bool m_runAnimation = true;
-    long long m_totalPauseTime = 0;
-    long long m_pauseStart = 0;
+    void GetBoneTransforms(double TimeInSeconds, std::vector<AffineMatrix>& Transforms, unsigned int AnimationIndex);
+    void GetBoneTransformsBlended(double TimeInSeconds, std::vector<AffineMatrix>& BlendedTransforms,
+                                  unsigned int StartAnimIndex, unsigned int EndAnimIndex, float BlendFactor);
+    // Every clip of Tree is sampled at TimeInSeconds, looping on its own duration
+    void GetBoneTransformsBlended(double TimeInSeconds, std::vector<AffineMatrix>& BlendedTransforms, const BlendTree& Tree);
+    // Per-node weights for BlendLayer::Mask, 1 on the subtrees rooted at the named nodes and 0
+    // elsewhere. Masks belong to the loaded skeleton, returns -1 when no node matches.
+    int CreateBoneMask(const std::vector<std::string>& RootNodeNames);
+
+    // Crowd interface. Instances are evaluated in parallel by UpdateInstances and drawn with
+    // their own world matrix and palette by RenderInstances. Each update publishes its palettes
+    // through a triple buffer and each render draws the latest published ones, so one thread can
+    // animate the next frame while another draws this one without either waiting. Instances
+    // must only be changed while no update runs.
+    uint CreateInstance(const glm::mat4& World, uint AnimationIndex = 0);
+    uint NumInstances() const { return (uint)m_Instances.size(); }
+    AnimationInstance& GetInstance(uint InstanceIndex) { return m_Instances[InstanceIndex]; }
+    void ClearInstances() { m_Instances.clear(); }
+    // Advances every instance and evaluates those due this update, returns how many were evaluated
+    uint UpdateInstances(double DeltaSeconds, const glm::vec3& CameraPos, gl::JobSystem& Jobs);
+    // Levels sorted by MinDistance, the first one should start at 0
+    void SetAnimationLODs(const std::vector<AnimationLOD>& LODs) { m_LODs = LODs; }
+    // Case-sensitive name fragments marking detail bones, whole subtrees below a match are detail
+    // too. Read by LoadMesh.
+    void SetDetailBonePatterns(const std::vector<std::string>& Patterns) { m_DetailBonePatterns = Patterns; }
+    void RenderInstances(const glm::mat4& view, const glm::mat4& proj);
+    // RenderInstances draws the whole crowd with one instanced draw per influence bucket, mesh and
+    // partition, so draw calls scale with materials instead of characters. Not used with the
+    // skinning cache, which holds the pose of one character at a time.
+    void SetInstancedDrawing(bool Enabled) { m_InstancedDrawing = Enabled; }
+    bool IsInstancedDrawingEnabled() const { return m_InstancedDrawing; }
+    // Draw calls of the last Render or RenderInstances call
+    uint GetNumDrawCalls() const { return m_NumDrawCalls; }
+
+    // Must not be called while UpdateInstances runs
+    void SetSkinningMode(SkinningMode Mode);
+    SkinningMode GetSkinningMode() const { return m_SkinningMode; }
+    // Skins the bind-pose vertices with the palette of the last Render, once per skinning mode, and
+    // compares the two results in model units
+    void MeasureSkinningError(float& MaxError, float& MeanError) const;
+    // GPU time of the last finished Render or RenderInstances call
+    double GetDrawTimeMs() const { return m_DrawTimeMs; }
+    // Palette bytes the last Render or RenderInstances call wrote, only the entries that changed
+    // since the buffer region was last used are sent
+    size_t GetPaletteUploadBytes() const { return m_PaletteUploadBytes; }
+    // Bones of all clips whose palette entries are evaluated once per clip instead of every update
+    uint GetNumStaticBones() const { return m_NumStaticBones; }
+    // Palette entries one character uploads, bones shared by several partitions count once per partition
+    uint GetNumPaletteEntries() const { return (uint)m_PartitionBones.size(); }
+    uint GetNumPalettePartitions() const { return (uint)m_Partitions.size(); }
+
+    // With the skinning cache on, each pose is skinned once into a vertex buffer (by a compute shader
+    // on GL 4.3+, transform feedback otherwise) and drawn from it with a static vertex shader. With
+    // pCpuJobs the cache is skinned on the CPU by those jobs instead and streamed to the GPU.
+    void SetSkinningCache(bool Enabled, gl::JobSystem* pCpuJobs = nullptr);
+    bool IsSkinningCacheEnabled() const { return m_SkinningCache; }
+    const char* GetSkinningCacheBackend() const {
+        return m_pCpuSkinningJobs ? "CPU" : m_computeProg != 0 ? "compute" : "transform feedback";
+    }
+    // Draws the pose last skinned into the cache again, for extra passes after Render
+    void DrawSkinningCache(const glm::mat4& WVP);
+
+    // Skins every vertex on the CPU in the current SkinningMode, SIMD across vertices and jobs across
+    // ranges of them. Out is in vertex buffer order, for picking, bounds or uploading.
+    void SkinVerticesCpu(const std::vector<AffineMatrix>& Transforms, gl::JobSystem& Jobs,
+                         std::vector<SkinnedPoint>& Out) const;
+    // Last pose skinned by the CPU skinning cache
+    const std::vector<SkinnedPoint>& GetCpuSkinnedVertices() const { return m_CpuSkinned; }
+    // CPU time spent skinning and uploading during the last Render or RenderInstances call
+    double GetCpuSkinningMs() const { return m_CpuSkinningMs; }
+
+    // Time of the single-character Render path, restarted by LoadMesh. Ticked by the owner once
+    // per frame, its delta is also what UpdateInstances expects.
+    AnimationClock& GetClock() { return m_Clock; }
+
     int m_animationIndex = 0;
     float m_blendFactor = 0.0f;
 
 private:
 
-#define MAX_NUM_BONES_PER_VERTEX 4
+#define MAX_NUM_BONES_PER_VERTEX 8
+// Triangles are drawn in buckets by the most influences any of their vertices has, up to
+// INFLUENCE_BUCKET_SIZE(b) = 1, 2, 4 and 8 influences
+#define NUM_INFLUENCE_BUCKETS 4
+#define INFLUENCE_BUCKET_SIZE(b) (1u << (b))
 #define INVALID_MATERIAL 0xFFFFFFFF
 
 
@@ -94,6 +242,10 @@ private:
     void ReserveSpace(unsigned int NumVertices, unsigned int NumIndices);
     void InitAllMeshes(const aiScene* pScene);
     void InitSingleMesh(uint MeshIndex, const aiMesh* paiMesh);
+    // Normalizes the influences of every vertex and reorders the triangles of each mesh by bucket
+    void BucketTrianglesByInfluences();
+    // Splits each mesh into MeshPartitions, duplicating the vertices partitions share
+    void PartitionMeshesByBones();
     bool InitMaterials(const aiScene* pScene, const std::string& Filename);
     void PopulateBuffers();
 
@@ -103,20 +255,50 @@ private:
     void LoadColors(const aiMaterial* pMaterial, int index);
 
     struct VertexBoneData {
-        uint BoneIDs[MAX_NUM_BONES_PER_VERTEX];
-        float Weights[MAX_NUM_BONES_PER_VERTEX];
+        uint BoneIDs[MAX_NUM_BONES_PER_VERTEX] = { 0 };
+        float Weights[MAX_NUM_BONES_PER_VERTEX] = { 0.0f };
 
         VertexBoneData(){}
 
+        // Past MAX_NUM_BONES_PER_VERTEX the lightest influence is dropped, Normalize then
+        // restores the sum
         void AddBoneData(uint BoneID, float Weight) {
+            uint Lightest = 0;
             for (uint i = 0 ; i < std::size(BoneIDs) ; i++) {
                 if (Weights[i] == 0.0) {
                     BoneIDs[i] = BoneID;
                     Weights[i] = Weight;
                     return;
                 }
+                if (Weights[i] < Weights[Lightest]) Lightest = i;
+            }
+            if (Weight > Weights[Lightest]) {
+                BoneIDs[Lightest] = BoneID;
+                Weights[Lightest] = Weight;
             }
-            assert(0);
+        }
+
+        // Sorts the influences heaviest first and scales them to sum to one, returns how many
+        // there are
+        uint Normalize() {
+            uint Count = 0;
+            float Sum = 0.0f;
+            for (uint i = 0 ; i < std::size(BoneIDs) ; i++) {
+                for (uint j = i ; j > 0 && Weights[j] > Weights[j - 1] ; j--) {
+                    std::swap(Weights[j], Weights[j - 1]);
+                    std::swap(BoneIDs[j], BoneIDs[j - 1]);
+                }
+            }
+            while (Count < std::size(BoneIDs) && Weights[Count] > 0.0f) Sum += Weights[Count++];
+            for (uint i = 0 ; i < Count ; i++) Weights[i] /= Sum;
+            return Count;
+        }
+
+        // Once normalized, the influences in use are the first ones
+        uint NumInfluences() const {
+            uint Count = 0;
+            while (Count < std::size(BoneIDs) && Weights[Count] > 0.0f) Count++;
+            return Count;
         }
     };
 
@@ -126,42 +308,137 @@ private:
         glm::vec3 Normal{};
         VertexBoneData Bones{};
     };
-    struct LocalTransform {
-        aiVector3D Scaling;
-        aiQuaternion Rotation;
-        aiVector3D Translation;
+    // The layout of the vertex buffer, decoded by the skinning shaders. Positions are unorm16
+    // within the mesh bounds, normals octahedral snorm16, texture coordinates half floats and
+    // weights unorm8 that sum to 255 with those of PackedExtraInfluences.
+    struct PackedSkinnedVertex {
+        uint16_t Position[3];   // m_PositionMin + Position / 65535 * m_PositionExtent
+        uint16_t Padding;
+        uint32_t Normal;        // packSnorm2x16 of the octahedral encoding
+        uint32_t TexCoords;     // packHalf2x16
+        uint8_t BoneIDs[4];     // influences 0 to 3, heaviest first
+        uint8_t Weights[4];
     };
-
+    // Influences 4 to 7, in their own stream that only meshes with such vertices have and only
+    // the 8 influence bucket reads
+    struct PackedExtraInfluences {
+        uint8_t BoneIDs[4];
+        uint8_t Weights[4];
+    };
+    // Quantizes m_SkinnedVertices into Packed and Extra and writes the decoded values back, so the
+    // CPU paths skin exactly the vertices the GPU sees. Extra stays empty when no vertex has more
+    // than 4 influences.
+    void PackVertices(std::vector<PackedSkinnedVertex>& Packed, std::vector<PackedExtraInfluences>& Extra);
+    void SetVertexDecodeUniforms(GLuint Program) const;
     void LoadMeshBones(uint MeshIndex, const aiMesh* pMesh, std::vector<SkinnedVertex>& SkinnedVertices, int BaseVertex);
     void LoadSingleBone(uint MeshIndex, const aiBone* pBone, std::vector<SkinnedVertex>& SkinnedVertices, int BaseVertex);
     int GetBoneId(const aiBone* pBone);
-    void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-    void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-    void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-    static uint FindScaling(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    static uint FindRotation(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    uint FindPosition(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    const aiNodeAnim* FindNodeAnim(const aiAnimation& pAnimation, const std::string& NodeName);
-    void CalcLocalTransform(LocalTransform& Transform, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim);
-    void ReadNodeHierarchy(float AnimationTimeTicks, const aiNode* pNode,
-                           const glm::mat4& ParentTransform, const aiAnimation& Animation);
-    void ReadNodeHierarchyBlended(float StartAnimationTimeTicks, float EndAnimationTimeTicks,
-                                               const aiNode* pNode, const glm::mat4& ParentTransform,
-                                               const aiAnimation& StartAnimation, const aiAnimation& EndAnimation,
-                                               float BlendFactor);
-
-    float CalcAnimationTimeTicks(float TimeInSeconds, unsigned int AnimationIndex);
+    void InitSkeleton(const aiScene* pScene);
+    void FlattenNode(const aiNode* pNode, int Parent, std::vector<const aiNode*>& Nodes, std::vector<int>& Parents);
+    bool IsDetailBone(const std::string& NodeName) const;
+    void InitTrackTable(const aiScene* pScene, std::vector<std::vector<uint>>& TrackChannels);
+    void BakeClips(const aiScene* pScene, const std::vector<std::vector<uint>>& TrackChannels);
+    // Core nodes whose node and every ancestor are untracked or hold their first key throughout
+    void FindStaticNodes(uint AnimationIndex, const std::vector<bool>& ConstantTracks, std::vector<bool>& StaticNodes);
+    // Numbers the clip's tracks of dynamic core nodes first, see ClipNodes::NumDynamicTracks
+    void ReorderStaticTracks(uint AnimationIndex, const std::vector<bool>& StaticNodes, BakedClip& Clip);
+    // Builds m_ClipNodes[AnimationIndex] from the clip as it will be sampled
+    void InitClipNodes(uint AnimationIndex, const std::vector<bool>& StaticNodes);
+    int GetTrack(uint AnimationIndex, uint NodeIndex) const {
+        return m_NodeTracks[(size_t)AnimationIndex * m_Skeleton.NumNodes() + NodeIndex];
+    }
+
+    // What RenderInstances draws, as published by one UpdateInstances
+    struct CrowdFrame {
+        std::vector<glm::mat4> Worlds;
+        std::vector<std::vector<AffineMatrix>> Palettes;
+        std::vector<std::vector<glm::mat2x4>> DualQuats;   // only filled when DualQuaternion is set
+        bool DualQuaternion = false;
+    };
+
+    // Everything a pose evaluation writes besides the palette. Evaluation only reads the mesh, so
+    // any number of them can run at once as long as each has its own scratch.
+    struct PoseScratch {
+        LocalPose Pose;
+        // Blend evaluation: the inputs and layers with a weight, and one sampled pose for each,
+        // inputs first. Only grown, so a steady blend does not allocate.
+        std::vector<BlendInput> BlendInputs;
+        std::vector<BlendLayer> BlendLayers;
+        std::vector<LocalPose> BlendPoses;
+        NodeTRS LocalTRS;
+        std::vector<glm::mat4> LocalTransforms;
+        std::vector<glm::mat4> GlobalTransforms;
+    };
+
+    void InitScratch(PoseScratch& Scratch) const;
+    // Room for blends of up to NumPoses inputs and layers
+    void ReserveBlendScratch(PoseScratch& Scratch, uint NumPoses) const;
+    // Only the clip's dynamic nodes are sampled and composed, see ClipNodes, and with SkipDetailBones
+    // only the core ones of them. KeepStaticBones leaves the entries of the clip's static bones as they
+    // are, for a palette that was last evaluated from the same clip.
+    void EvaluateSkeleton(float AnimationTimeTicks, uint AnimationIndex, bool SkipDetailBones,
+                          PoseScratch& Scratch, AffineMatrix* pPalette, bool KeepStaticBones = false) const;
+    void EvaluateBlend(double TimeInSeconds, const BlendInput* pInputs, uint NumInputs, const BlendLayer* pLayers,
+                       uint NumLayers, bool SkipDetailBones, PoseScratch& Scratch, AffineMatrix* pPalette) const;
+    void EvaluateInstance(AnimationInstance& Instance, bool SkipDetailBones, PoseScratch& Scratch) const;
+    // Writes the entries of the bones pBoneNodes maps to a node, see Skeleton::BoneNodes
+    void UpdatePalette(uint NumAnimatedNodes, PoseScratch& Scratch, const int* pBoneNodes,
+                       AffineMatrix* pPalette) const;
+    // Single-character path, evaluated into m_BoneTransforms
+    void UpdateBoneTransforms(double TimeInSeconds, uint AnimationIndex);
+    void UpdateBoneTransformsBlended(double TimeInSeconds, uint StartAnimIndex, uint EndAnimIndex, float BlendFactor);
+    void BuildPoseCache();
+    // False when the clip is not cached
+    bool SamplePoseCache(float AnimationTimeTicks, uint AnimationIndex, AffineMatrix* pPalette) const;
+    uint NumTracksToSample(uint AnimationIndex, bool SkipDetailBones) const;
+
+    float CalcAnimationTimeTicks(double TimeInSeconds, unsigned int AnimationIndex) const;
+
+    void SetCameraUniforms();
+    // Writes the palettes of Count characters into this frame's region of m_PaletteBuffer, one
+    // slot each of m_PartitionStride per partition. pDualQuats is only read in dual quaternion mode.
+    void UploadPalettes(const std::vector<AffineMatrix>* pTransforms, const std::vector<glm::mat2x4>* pDualQuats,
+                        uint Count);
+    // Binds the palette of one partition of one character for the skinning vertex shaders and the
+    // compute stage
+    void BindPalette(uint Index, uint Partition);
+    // Only CPU skinning does without the palette on the GPU
+    bool UsesPaletteBuffer() const { return !m_SkinningCache || !m_pCpuSkinningJobs; }
+    void InitSkinningCachePrograms();
+    void InitSkinningCache();
+    // The GPU stages read slot PaletteSlot of the palette buffer, the CPU one reads the arguments
+    void SkinIntoCache(const std::vector<AffineMatrix>& Transforms, const std::vector<glm::mat2x4>& DualQuats,
+                       uint PaletteSlot);
+    void SkinVerticesCpu(const std::vector<AffineMatrix>& Transforms, const std::vector<glm::mat2x4>& DualQuats,
+                         gl::JobSystem& Jobs, std::vector<SkinnedPoint>& Out) const;
+    void UseSkinningProgram();
+    // Makes Program current and fetches the uniform locations of it
+    void UseDrawProgram(GLuint Program);
+    void BeginDrawTimer();
+    void EndDrawTimer();
+    // Every triangle, or only those of one influence bucket. With a PaletteSlot each partition binds
+    // its palette from that slot first. With NumInstances an instanced program is current instead,
+    // and each partition draws that many characters from slot PaletteSlot on.
+    void DrawMeshes(int Bucket = -1, int PaletteSlot = -1, uint NumInstances = 0);
+    // Draws Count characters from m_VAO, each with its world matrix and its palette slot, bucket by
+    // bucket so each shader variant is bound once
+    void DrawInfluenceBuckets(const glm::mat4& ViewProj, const glm::mat4* pWorlds, uint Count);
+    // As DrawInfluenceBuckets, with all Count characters in each draw call. Falls back to it when the
+    // buffers outgrow what a buffer texture can address.
+    void DrawInstancedBuckets(const glm::mat4& ViewProj, const glm::mat4* pWorlds, uint Count);
 
     enum BUFFER_TYPE {
         INDEX_BUFFER = 0,
         POS_VB       = 1,
         TEXCOORD_VB  = 2,
         NORMAL_VB    = 3,
-        BONE_VB      = 4,
-        NUM_BUFFERS  = 5
+        BONE_VB      = 4,   // PackedExtraInfluences, empty when no vertex has more than 4
+        SKINNED_VB   = 5,   // skinning cache, position and normal per vertex
+        NUM_BUFFERS  = 6
     };
 
     GLuint m_VAO = 0;
+    GLuint m_SkinnedVAO = 0;    // reads SKINNED_VB, plus the texture coordinates of POS_VB
     GLuint m_Buffers[NUM_BUFFERS] = { 0 };
 
     struct BasicMeshEntry {
@@ -176,11 +453,27 @@ private:
         unsigned int BaseVertex;
         unsigned int BaseIndex;
         unsigned int MaterialIndex;
+        unsigned int FirstPartition = 0;    // in m_Partitions
+        unsigned int NumPartitions = 0;
+    };
+
+    // Consecutive triangles of one mesh whose vertices reference at most MAX_BONES bones. Its
+    // vertices are its own, so the vertex buffer holds bone IDs into the partition's palette.
+    struct MeshPartition {
+        unsigned int BaseVertex = 0;
+        unsigned int NumVertices = 0;
+        unsigned int BaseIndex = 0;         // indices are relative to BaseVertex
+        // Triangles grouped by influence bucket, bucket b is [BucketEnds[b - 1], BucketEnds[b]) from BaseIndex
+        unsigned int BucketEnds[NUM_INFLUENCE_BUCKETS] = {};
+        unsigned int FirstBone = 0;         // in m_PartitionBones
+        unsigned int NumBones = 0;
     };
 
     Assimp::Importer Importer;
     const aiScene* pScene = NULL;
     std::vector<BasicMeshEntry> m_Meshes;
+    std::vector<MeshPartition> m_Partitions;
+    std::vector<uint> m_PartitionBones;     // bone behind each palette entry of each partition
     std::vector<Material> m_Materials;
 
     // Temporary space for vertex stuff before we load them into the GPU
@@ -190,20 +483,104 @@ private:
     std::vector<unsigned int> m_Indices;
     std::vector<VertexBoneData> m_Bones;
     std::vector<SkinnedVertex> m_SkinnedVertices;
+    uint m_MaxInfluenceBucket = 0;              // bucket of the vertex with the most influences
+    uint m_BucketIndices[NUM_INFLUENCE_BUCKETS] = {};  // summed over meshes
+    glm::vec3 m_PositionMin = glm::vec3(0.0f);     // bounds the packed positions are relative to
+    glm::vec3 m_PositionExtent = glm::vec3(0.0f);
+
+    NameTable m_BoneNames;  // bone name ID is the index into m_BoneOffsets
+
+    // Node hierarchy flattened once in LoadMesh. Nodes are stored depth-first, so a parent
+    // always precedes its children and a pose is evaluated with a single forward loop. Detail
+    // subtrees (fingers, face, ...) are moved behind all other nodes, still depth-first, so a
+    // reduced LOD evaluates the leading NumCoreNodes nodes and attaches the rest to them.
+    struct Skeleton {
+        uint NumCoreNodes = 0;
+        std::vector<int> Parents;          // -1 for the root
+        NodeTRS BindLocals;                // aiNode::mTransformation decomposed, used when a node is not animated
+        std::vector<int> BoneSlots;        // index into m_BoneOffsets, -1 for nodes that are not bones
+        std::vector<int> BoneNodes;        // inverse of BoneSlots, -1 for bones with no node in the hierarchy
+        // Names are interned at load and never read per frame
+        NameTable NodeNames;
+        std::vector<uint> NameIDs;         // per node, into NodeNames
+        std::vector<int> NamedNodes;       // per name ID, the first node with that name in depth-first order
+        // Per detail node, indexed from NumCoreNodes: nearest core ancestor and the bind-pose
+        // transform from that ancestor down to the node
+        std::vector<int> DetailAnchors;
+        std::vector<glm::mat4> DetailFromAnchor;
+
+        uint NumNodes() const { return (uint)Parents.size(); }
+    };
 
-    std::map<std::string, uint> m_BoneNameToIndexMap;
-
-    struct BoneInfo {
-        glm::mat4 OffsetMatrix;
-        glm::mat4 FinalTransformation;
-
-        BoneInfo(const glm::mat4& Offset) {
-            OffsetMatrix = Offset;
-            FinalTransformation = glm::mat4(0.0f);
-        }
+    Skeleton m_Skeleton;
+
+    // Clips baked from pScene->mAnimations at load, one track per animated node numbered in
+    // skeleton order. The scene is released once they are built.
+    std::vector<std::unique_ptr<AnimationClip>> m_Clips;
+    std::vector<uint> m_NumCoreTracks;  // per clip, tracks [0, n) animate core nodes
+    float m_MaxPositionError = 0.0f;
+    float m_MaxRotationError = 0.0f;
+    // Dense (animation, node) -> track table, -1 where the node is not animated by that clip
+    std::vector<int> m_NodeTracks;
+    // The nodes one clip moves. Static nodes, core nodes whose node and every ancestor are
+    // untracked or hold their first key throughout, have their globals and palette entries
+    // computed at bake and are never sampled, composed or concatenated again while the clip plays
+    // alone. Their tracks are numbered after the clip's other core tracks.
+    struct ClipNodes {
+        uint NumDynamicTracks = 0;          // tracks [0, n) animate the dynamic core nodes
+        uint NumCoreNodes = 0;              // Nodes [0, n) are core nodes, the rest detail nodes
+        std::vector<int> Nodes;             // the dynamic nodes in skeleton order
+        std::vector<int> Parents;           // per entry of Nodes, into Nodes, -1 for the root and below static nodes
+        NodeTRS BindLocals;                 // Skeleton::BindLocals of Nodes
+        // Entries of Nodes whose parent is static, and the global of that parent
+        std::vector<uint> AttachedNodes;
+        std::vector<glm::mat4> AttachGlobals;
+        // As Skeleton::DetailAnchors into Nodes, -1 where the anchor is static and its global is
+        // folded into DetailFromAnchor
+        std::vector<int> DetailAnchors;
+        std::vector<glm::mat4> DetailFromAnchor;
+        std::vector<int> BoneNodes;         // per bone, into Nodes, -1 for static bones and bones without a node
+        std::vector<uint> StaticBones;
+        std::vector<AffineMatrix> StaticPalette;    // per entry of StaticBones
     };
+    std::vector<ClipNodes> m_ClipNodes;
+    uint m_NumStaticBones = 0;              // summed over clips
+    // First frame of every clip, what additive layers are relative to
+    std::vector<LocalPose> m_ReferencePoses;
+    std::vector<std::vector<float>> m_BoneMasks;    // per node, see CreateBoneMask
+
+    // Palettes of one clip at evenly spaced times over its loop, both ends included. NumFrames is
+    // 0 for clips left out of the budget.
+    struct CachedClip {
+        uint NumFrames = 0;
+        float FramesPerTick = 0.0f;
+        std::vector<AffineMatrix> Palettes;    // [frame][bone]
+    };
+    std::vector<CachedClip> m_PoseCache;
+    float m_PoseCacheRate = 0.0f;
+    size_t m_PoseCacheBudget = 0;
+    size_t m_PoseCacheBytes = 0;
+
+    // Scratch for the single-character path, and one per job system thread for the crowd path
+    PoseScratch m_Scratch;
+    std::vector<PoseScratch> m_WorkerScratch;
+    std::vector<AnimationInstance> m_Instances;
+    AnimationClock m_Clock;
+    gl::TripleBuffer<CrowdFrame> m_CrowdFrames;    // written by UpdateInstances, read by RenderInstances
+    std::vector<AnimationLOD> m_LODs = {
+        { 0.0f, 1, false },
+        { 60.0f, 2, false },
+        { 150.0f, 4, true },
+    };
+    std::vector<std::string> m_DetailBonePatterns = {
+        "Thumb", "Index", "Middle", "Ring", "Pinky", "Finger", "Toe", "Eye", "Jaw", "Tongue", "_End", "_end"
+    };
+    uint m_UpdateCount = 0;
 
-    std::vector<BoneInfo> m_BoneInfo;
+    std::vector<glm::mat4> m_BoneOffsets;
+    std::vector<AffineMatrix> m_BoneTransforms; // palette of the single-character path, zero for bones never
+                                             // reached by the hierarchy
+    int m_PaletteClip = -1;                  // as AnimationInstance::PaletteClip, for m_BoneTransforms
     glm::mat4 m_GlobalInverseTransform;
     glm::mat4 FinalTrans;
     glm::mat4 world;
@@ -212,9 +589,62 @@ private:
     GLuint samplerLoc;
     GLuint samplerSpecularExponentLoc;
     GLuint CameraLocalPosLoc;
-
-    GLuint m_boneLocation[MAX_BONES];
-    GLuint m_shaderProg = 0;
+    // -1 in the programs that do not draw instanced
+    GLint PaletteBaseLoc = -1;
+    GLint PaletteStrideLoc = -1;
+    GLint WorldBaseLoc = -1;
+
+    // Palettes of every character drawn this frame, bound a partition of a slot at a time. Each
+    // partition holds a whole BonePalette block whichever the mode, padded to the offset alignment
+    // of uniform and storage buffers and to whole texels of m_PaletteTexture.
+    gl::StreamBuffer m_PaletteBuffer;
+    GLsizeiptr m_PartitionStride = 0;
+    GLsizeiptr GetPaletteStride() const { return m_PartitionStride * (GLsizeiptr)m_Partitions.size(); }
+    // What UploadPalettes last wrote to each slot, and the m_PaletteBuffer frame each entry last
+    // changed in. A region is only sent the entries that changed since it was last written.
+    std::vector<unsigned char> m_PaletteShadow;     // [slot][entry of m_PartitionBones], entries of the current mode
+    std::vector<uint64_t> m_PaletteChangedFrame;    // [slot][entry]
+    uint m_PaletteShadowSlots = 0;
+    bool m_PaletteShadowDualQuats = false;
+    size_t m_PaletteUploadBytes = 0;
+    GLuint m_shaderProg = 0;    // the program the uniform locations below belong to
+    // Per SkinningMode and influence bucket, the vertex shader compiled with NUM_INFLUENCES
+    GLuint m_skinningProgs[2][NUM_INFLUENCE_BUCKETS] = {};
+    // As m_skinningProgs, compiled with INSTANCED. They read the palette buffer and the world
+    // matrices of the crowd as buffer textures.
+    GLuint m_instancedProgs[2][NUM_INFLUENCE_BUCKETS] = {};
+    bool m_InstancedDrawing = true;
+    GLuint m_PaletteTexture = 0;
+    GLuint m_InstanceWorldTexture = 0;
+    gl::StreamBuffer m_InstanceWorldBuffer;     // a glm::mat4 per character drawn instanced this frame
+    GLint m_MaxTextureBufferTexels = 0;
+    uint m_NumDrawCalls = 0;
+    SkinningMode m_SkinningMode = SkinningMode::LinearBlend;
+    std::vector<glm::mat2x4> m_DualQuats;
+
+    // Skinning cache. m_shaderProg is m_cachedDrawProg while it is on.
+    bool m_SkinningCache = false;
+    GLuint m_cachedDrawProg = 0;
+    // As m_skinningProgs, 0 when the compute stage is used. The m_MaxInfluenceBucket variant skins
+    // every vertex.
+    GLuint m_feedbackProgs[2][NUM_INFLUENCE_BUCKETS] = {};
+    GLuint m_computeProg = 0;
+    GLuint m_computeBaseVertexLocation;
+    GLuint m_computeNumVerticesLocation;
+    GLuint m_computeDualQuaternionLocation;
+    GLuint m_computeNumInfluencesLocation;
+
+    // CPU skinning backend of the cache
+    SkinningVertices m_SkinningVertices;      // m_SkinnedVertices rearranged for the SIMD kernels
+    gl::JobSystem* m_pCpuSkinningJobs = nullptr;
+    std::vector<SkinnedPoint> m_CpuSkinned;
+    double m_CpuSkinningMs = 0.0;
+    double m_CpuSkinningPendingMs = 0.0;      // summed over the current draw call
+
+    // Two timer queries used in turn, so reading one never waits on the draw just issued
+    GLuint m_drawTimerQueries[2] = { 0, 0 };
+    unsigned int m_drawTimerFrame = 0;
+    double m_DrawTimeMs = 0.0;
 
     struct {
         GLuint AmbientColor;
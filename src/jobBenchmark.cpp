@@ -0,0 +1,82 @@
+#include "jobBenchmark.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace gl {
+
+    // A few hundred nanoseconds of dependent math, enough that scheduling overhead shows up but
+    // does not dominate
+    static float BusyWork(unsigned int Seed) {
+        float x = (float)Seed * 0.001f;
+        for (int i = 0 ; i < 64 ; i++) x = std::sin(x) * 0.5f + std::cos(x + (float)i);
+        return x;
+    }
+
+    // Binary tree of jobs where every inner job spawns two children and waits on them, which
+    // exercises stealing and the helping wait much harder than a flat loop
+    static void SpawnTree(JobSystem& Jobs, unsigned int Depth, unsigned int Seed, std::vector<float>& Results) {
+        if (Depth == 0) {
+            Results[Seed] = BusyWork(Seed);
+            return;
+        }
+
+        Job* pGroup = Jobs.CreateJob([] {});
+        Jobs.Run(Jobs.CreateChildJob(pGroup, [&Jobs, &Results, Depth, Seed] {
+            SpawnTree(Jobs, Depth - 1, Seed * 2, Results);
+        }));
+        Jobs.Run(Jobs.CreateChildJob(pGroup, [&Jobs, &Results, Depth, Seed] {
+            SpawnTree(Jobs, Depth - 1, Seed * 2 + 1, Results);
+        }));
+        Jobs.Run(pGroup);
+        Jobs.Wait(pGroup);
+    }
+
+    template<typename Function>
+    static double MeasureMs(int Repeats, const Function& Body) {
+        Body(); // warm-up, wakes the workers and touches the buffers
+        auto Start = std::chrono::steady_clock::now();
+        for (int i = 0 ; i < Repeats ; i++) Body();
+        auto End = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(End - Start).count() / Repeats;
+    }
+
+    void RunJobBenchmark(unsigned int MaxThreads) {
+        if (MaxThreads == 0) MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        constexpr unsigned int LOOP_ITEMS = 1 << 16;
+        constexpr unsigned int LOOP_BATCH = 64;
+        constexpr unsigned int TREE_DEPTH = 14;
+        constexpr int REPEATS = 10;
+
+        std::vector<float> LoopResults(LOOP_ITEMS);
+        std::vector<float> TreeResults(1u << TREE_DEPTH);
+        double LoopBaseMs = 0.0, TreeBaseMs = 0.0;
+
+        printf("Job system stress test, %u items in batches of %u, tree of %u leaves\n",
+               LOOP_ITEMS, LOOP_BATCH, 1u << TREE_DEPTH);
+        printf("threads   parallel for (ms)  speedup   job tree (ms)  speedup\n");
+
+        for (unsigned int Threads = 1 ; Threads <= MaxThreads ; Threads++) {
+            JobSystem Jobs((int)Threads - 1);
+
+            double LoopMs = MeasureMs(REPEATS, [&] {
+                Jobs.ParallelFor(LOOP_ITEMS, LOOP_BATCH, [&](unsigned int Begin, unsigned int End, unsigned int) {
+                    for (unsigned int i = Begin ; i < End ; i++) LoopResults[i] = BusyWork(i);
+                });
+            });
+            double TreeMs = MeasureMs(REPEATS, [&] { SpawnTree(Jobs, TREE_DEPTH, 0, TreeResults); });
+
+            if (Threads == 1) {
+                LoopBaseMs = LoopMs;
+                TreeBaseMs = TreeMs;
+            }
+            printf("%7u   %17.2f  %6.2fx   %13.2f  %6.2fx\n", Threads, LoopMs, LoopBaseMs / LoopMs,
+                   TreeMs, TreeBaseMs / TreeMs);
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace gl {
+    // Stress test for gl::JobSystem, run with `viewer --job-benchmark`. Times a flat parallel loop
+    // and a deep tree of nested jobs from one thread up to MaxThreads (0 for every hardware thread)
+    // and prints the speedup over the single-threaded run.
+    void RunJobBenchmark(unsigned int MaxThreads = 0);
+}
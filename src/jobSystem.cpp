@@ -0,0 +1,237 @@
+#include "jobSystem.h"
+
+#include <cassert>
+
+namespace gl {
+
+    // Identity of the calling thread. The thread that builds a system is its worker 0 without
+    // registering, so these are only set on spawned workers.
+    static thread_local const JobSystem* tl_pSystem = nullptr;
+    static thread_local unsigned int tl_Worker = 0;
+
+    // ------------------------------------------------------------------------------------------------
+    // WorkQueue
+
+    // The owner's store to m_Bottom in Pop and the thieves' loads in Steal are seq_cst so that a
+    // thief and the owner racing for the last job always see each other's claim.
+
+    bool JobSystem::WorkQueue::Push(Job* pJob) {
+        int64_t Bottom = m_Bottom.load(std::memory_order_relaxed);
+        int64_t Top = m_Top.load(std::memory_order_acquire);
+        if (Bottom - Top >= CAPACITY) return false;
+
+        m_Jobs[Bottom & (CAPACITY - 1)].store(pJob, std::memory_order_relaxed);
+        m_Bottom.store(Bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    Job* JobSystem::WorkQueue::Pop() {
+        int64_t Bottom = m_Bottom.load(std::memory_order_relaxed) - 1;
+        m_Bottom.store(Bottom, std::memory_order_seq_cst);
+        int64_t Top = m_Top.load(std::memory_order_seq_cst);
+
+        if (Top > Bottom) {
+            m_Bottom.store(Bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        Job* pJob = m_Jobs[Bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (Top == Bottom) {
+            // Last job in the queue, race the thieves for it
+            if (!m_Top.compare_exchange_strong(Top, Top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                pJob = nullptr;
+            }
+            m_Bottom.store(Bottom + 1, std::memory_order_relaxed);
+        }
+        return pJob;
+    }
+
+    Job* JobSystem::WorkQueue::Steal() {
+        int64_t Top = m_Top.load(std::memory_order_seq_cst);
+        int64_t Bottom = m_Bottom.load(std::memory_order_seq_cst);
+        if (Top >= Bottom) return nullptr;
+
+        Job* pJob = m_Jobs[Top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!m_Top.compare_exchange_strong(Top, Top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return pJob;
+    }
+
+    // ------------------------------------------------------------------------------------------------
+    // JobSystem
+
+    JobSystem::JobSystem(int NumWorkers) {
+        if (NumWorkers < 0) {
+            int HardwareThreads = (int)std::thread::hardware_concurrency();
+            NumWorkers = HardwareThreads > 1 ? HardwareThreads - 1 : 0;
+        }
+
+        for (int i = 0 ; i < NumWorkers + 1 ; i++) {
+            m_Queues.push_back(std::make_unique<WorkQueue>());
+            m_Rings.push_back(std::make_unique<JobRing>());
+        }
+
+        m_Workers.reserve(NumWorkers);
+        for (int i = 1 ; i <= NumWorkers ; i++) {
+            m_Workers.emplace_back(&JobSystem::WorkerLoop, this, (unsigned int)i);
+        }
+    }
+
+    JobSystem::~JobSystem() {
+        {
+            std::lock_guard<std::mutex> Lock(m_SleepMutex);
+            m_Quit.store(true);
+        }
+        m_WakeUp.notify_all();
+        for (auto& Worker : m_Workers) Worker.join();
+    }
+
+    unsigned int JobSystem::GetWorkerIndex() const {
+        return tl_pSystem == this ? tl_Worker : 0;
+    }
+
+    Job* JobSystem::AllocateJob(Job* Parent) {
+        unsigned int Worker = GetWorkerIndex();
+        JobRing& Ring = *m_Rings[Worker];
+
+        // Jobs mostly finish in allocation order, but a range split early can stay queued while its
+        // sibling allocates thousands, so skip over slots that are still alive
+        Job* pJob = nullptr;
+        while (!pJob) {
+            for (uint32_t Probe = 0 ; Probe < MAX_JOBS_PER_THREAD && !pJob ; Probe++) {
+                Job* pSlot = &Ring.Jobs[Ring.Next++ & (MAX_JOBS_PER_THREAD - 1)];
+                if (pSlot->UnfinishedJobs.load(std::memory_order_acquire) == 0) pJob = pSlot;
+            }
+
+            if (!pJob) {
+                assert(0 && "Too many jobs alive on one thread");
+                if (Job* pOther = FindJob(Worker)) Execute(pOther);
+            }
+        }
+
+        pJob->Parent = Parent;
+        pJob->UnfinishedJobs.store(1, std::memory_order_relaxed);
+        if (Parent) Parent->UnfinishedJobs.fetch_add(1, std::memory_order_relaxed);
+        return pJob;
+    }
+
+    void JobSystem::Run(Job* pJob) {
+        WorkQueue& Queue = *m_Queues[GetWorkerIndex()];
+        if (!Queue.Push(pJob)) {
+            // Queue full, running it here keeps the ordering guarantees and bounds the memory
+            Execute(pJob);
+            return;
+        }
+
+        m_QueuedJobs.fetch_add(1, std::memory_order_seq_cst);
+        if (m_Sleepers.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> Lock(m_SleepMutex);
+            m_WakeUp.notify_one();
+        }
+    }
+
+    void JobSystem::RunOnWorker(Job* pJob) {
+        if (m_Workers.empty()) {
+            Execute(pJob);
+            return;
+        }
+
+        bool Queued = false;
+        {
+            std::lock_guard<std::mutex> Lock(m_WorkerOnlyMutex);
+            if (m_WorkerOnlyTail - m_WorkerOnlyHead < MAX_WORKER_ONLY_JOBS) {
+                m_WorkerOnlyJobs[m_WorkerOnlyTail++ % MAX_WORKER_ONLY_JOBS] = pJob;
+                m_NumWorkerOnlyJobs.fetch_add(1, std::memory_order_relaxed);
+                Queued = true;
+            }
+        }
+        if (!Queued) {
+            // Same fallback as a full deque in Run
+            Execute(pJob);
+            return;
+        }
+
+        m_QueuedJobs.fetch_add(1, std::memory_order_seq_cst);
+        if (m_Sleepers.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> Lock(m_SleepMutex);
+            m_WakeUp.notify_one();
+        }
+    }
+
+    void JobSystem::Wait(const Job* pJob) {
+        unsigned int Worker = GetWorkerIndex();
+        while (pJob->UnfinishedJobs.load(std::memory_order_acquire) > 0) {
+            if (Job* pNext = FindJob(Worker)) {
+                Execute(pNext);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    Job* JobSystem::FindJob(unsigned int Worker) {
+        Job* pJob = m_Queues[Worker]->Pop();
+        if (!pJob && Worker != 0 && m_NumWorkerOnlyJobs.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> Lock(m_WorkerOnlyMutex);
+            if (m_WorkerOnlyHead != m_WorkerOnlyTail) {
+                pJob = m_WorkerOnlyJobs[m_WorkerOnlyHead++ % MAX_WORKER_ONLY_JOBS];
+                m_NumWorkerOnlyJobs.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if (!pJob) {
+            // Start at a different victim per thread so thieves do not all hammer the same queue
+            unsigned int NumQueues = (unsigned int)m_Queues.size();
+            for (unsigned int i = 1 ; i < NumQueues && !pJob ; i++) {
+                pJob = m_Queues[(Worker + i) % NumQueues]->Steal();
+            }
+        }
+
+        if (pJob) m_QueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+        return pJob;
+    }
+
+    void JobSystem::Execute(Job* pJob) {
+        pJob->Function(*pJob);
+        Finish(pJob);
+    }
+
+    void JobSystem::Finish(Job* pJob) {
+        // Read before the decrement, the slot may be reused as soon as the count hits zero. acq_rel so
+        // whoever sees it hit zero also sees every write the job and its children made.
+        Job* Parent = pJob->Parent;
+        if (pJob->UnfinishedJobs.fetch_sub(1, std::memory_order_acq_rel) == 1 && Parent) {
+            Finish(Parent);
+        }
+    }
+
+    void JobSystem::WorkerLoop(unsigned int Worker) {
+        tl_pSystem = this;
+        tl_Worker = Worker;
+
+        // Spin briefly before sleeping, frames tend to push work in bursts
+        constexpr int SPINS_BEFORE_SLEEP = 64;
+        int Spins = 0;
+
+        while (!m_Quit.load(std::memory_order_relaxed)) {
+            if (Job* pJob = FindJob(Worker)) {
+                Execute(pJob);
+                Spins = 0;
+                continue;
+            }
+
+            if (++Spins < SPINS_BEFORE_SLEEP) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> Lock(m_SleepMutex);
+            m_Sleepers.fetch_add(1, std::memory_order_seq_cst);
+            m_WakeUp.wait(Lock, [this] {
+                return m_Quit.load(std::memory_order_relaxed) || m_QueuedJobs.load(std::memory_order_seq_cst) > 0;
+            });
+            m_Sleepers.fetch_sub(1, std::memory_order_relaxed);
+            Spins = 0;
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define MAX_JOBS_PER_THREAD 4096
+#define MAX_WORKER_ONLY_JOBS 64
+#define JOB_DATA_SIZE 48
+
+namespace gl {
+    // A unit of work. The callable is stored inline, so creating a job never allocates. A job is
+    // finished once its own function has returned and every child created under it is finished.
+    struct alignas(64) Job {
+        void (*Function)(Job&) = nullptr;
+        Job* Parent = nullptr;
+        std::atomic<int> UnfinishedJobs{0};
+        alignas(16) unsigned char Data[JOB_DATA_SIZE];
+    };
+
+    // Work-stealing scheduler. Every thread, including the one that created the system, owns a
+    // deque: it pushes and pops at the bottom while idle threads steal from the top of others.
+    // Wait() keeps running jobs until the awaited one is finished, so it never blocks a worker.
+    class JobSystem {
+    public:
+        // Negative picks one worker per hardware thread minus the caller, 0 runs every job on the caller
+        explicit JobSystem(int NumWorkers = -1);
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        unsigned int NumThreads() const { return (unsigned int)m_Queues.size(); }
+        // Index of the calling thread in [0, NumThreads()), 0 for the thread that built the system
+        unsigned int GetWorkerIndex() const;
+
+        template<typename Function>
+        Job* CreateJob(Function&& Func) { return CreateChildJob(nullptr, std::forward<Function>(Func)); }
+
+        // Parent is not finished before this job is, it must not have been waited on yet
+        template<typename Function>
+        Job* CreateChildJob(Job* Parent, Function&& Func) {
+            using Stored = std::decay_t<Function>;
+            static_assert(sizeof(Stored) <= JOB_DATA_SIZE, "Job callable too large, capture by reference instead");
+            static_assert(alignof(Stored) <= 16, "Job callable over-aligned");
+
+            Job* pJob = AllocateJob(Parent);
+            new (pJob->Data) Stored(std::forward<Function>(Func));
+            pJob->Function = [](Job& Self) {
+                Stored* pFunc = std::launder(reinterpret_cast<Stored*>(Self.Data));
+                (*pFunc)();
+                pFunc->~Stored();
+            };
+            return pJob;
+        }
+
+        // Makes the job visible to all threads. Jobs must only be run from a thread of this system.
+        void Run(Job* pJob);
+        // Hands the job to the spawned workers only, the thread that built the system never picks it
+        // up, not even while it waits on other jobs. Without workers the job runs here before returning.
+        void RunOnWorker(Job* pJob);
+        // Executes other jobs until pJob is finished
+        void Wait(const Job* pJob);
+
+        // Runs Body(Begin, End, Worker) over [0, Count) in batches of at most BatchSize items and waits
+        // for all of them. Worker is the index of the thread running the batch. Ranges are split in
+        // halves by the jobs themselves, so only a handful of jobs are alive per thread at any time.
+        template<typename Function>
+        void ParallelFor(unsigned int Count, unsigned int BatchSize, const Function& Body) {
+            if (Count == 0) return;
+            if (BatchSize == 0) BatchSize = 1;
+            Job* pRoot = CreateJob([] {});
+            Run(CreateRangeJob(pRoot, 0, Count, BatchSize, Body));
+            Run(pRoot);
+            Wait(pRoot);
+        }
+
+    private:
+        // Fixed-capacity Chase-Lev deque. Only the owner calls Push and Pop, any thread may Steal.
+        class WorkQueue {
+        public:
+            bool Push(Job* pJob);
+            Job* Pop();
+            Job* Steal();
+
+        private:
+            static constexpr int64_t CAPACITY = MAX_JOBS_PER_THREAD;
+            alignas(64) std::atomic<int64_t> m_Top{0};
+            alignas(64) std::atomic<int64_t> m_Bottom{0};
+            std::atomic<Job*> m_Jobs[CAPACITY];
+        };
+
+        // Per-thread job storage, recycled round-robin. A thread may not have more than
+        // MAX_JOBS_PER_THREAD jobs alive at once.
+        struct JobRing {
+            std::unique_ptr<Job[]> Jobs{new Job[MAX_JOBS_PER_THREAD]};
+            uint32_t Next = 0;
+        };
+
+        template<typename Function>
+        Job* CreateRangeJob(Job* Parent, unsigned int Begin, unsigned int End, unsigned int BatchSize,
+                            const Function& Body) {
+            return CreateChildJob(Parent, [this, Parent, &Body, Begin, End, BatchSize] {
+                if (End - Begin <= BatchSize) {
+                    Body(Begin, End, GetWorkerIndex());
+                    return;
+                }
+                unsigned int Middle = Begin + (End - Begin) / 2;
+                Run(CreateRangeJob(Parent, Middle, End, BatchSize, Body));
+                Run(CreateRangeJob(Parent, Begin, Middle, BatchSize, Body));
+            });
+        }
+
+        Job* AllocateJob(Job* Parent);
+        Job* FindJob(unsigned int Worker);
+        void Execute(Job* pJob);
+        void Finish(Job* pJob);
+        void WorkerLoop(unsigned int Worker);
+
+        std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+        std::vector<std::unique_ptr<JobRing>> m_Rings;
+        std::vector<std::thread> m_Workers;
+
+        // Jobs from RunOnWorker, taken by any worker but 0. Rarely used, so a lock is fine.
+        std::mutex m_WorkerOnlyMutex;
+        Job* m_WorkerOnlyJobs[MAX_WORKER_ONLY_JOBS] = {};
+        uint32_t m_WorkerOnlyHead = 0;
+        uint32_t m_WorkerOnlyTail = 0;
+        std::atomic<int> m_NumWorkerOnlyJobs{0};
+
+        // Sleeping workers are woken only when there is somebody to wake
+        std::mutex m_SleepMutex;
+        std::condition_variable m_WakeUp;
+        std::atomic<int> m_QueuedJobs{0};
+        std::atomic<int> m_Sleepers{0};
+        std::atomic<bool> m_Quit{false};
+    };
+}
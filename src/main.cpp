@@ -1,4 +1,7 @@
 #include "window.h"
+#include "jobBenchmark.h"
+#include "skinningBenchmark.h"
+#include "animationBenchmark.h"
 
 int main(int argc, char *argv[])
 {
@@ -7,9 +10,43 @@ int main(int argc, char *argv[])
     if (argc < 2)
     {
         std::cout << "Usage: viewer [filename.obj]" << std::endl;
+        std::cout << "       viewer --job-benchmark" << std::endl;
+        std::cout << "       viewer --skinning-benchmark [filename.dae]" << std::endl;
+        std::cout << "       viewer --keyframe-benchmark" << std::endl;
+        std::cout << "       viewer --channel-benchmark [filename.dae ...]" << std::endl;
+        std::cout << "       viewer --clip-benchmark [filename.dae]" << std::endl;
         return 0;
     }
 
+    if (std::string(argv[1]) == "--job-benchmark")
+    {
+        gl::RunJobBenchmark();
+        return 0;
+    }
+
+    if (std::string(argv[1]) == "--keyframe-benchmark")
+    {
+        gl::RunKeyframeBenchmark();
+        return 0;
+    }
+
+    if (std::string(argv[1]) == "--channel-benchmark")
+    {
+        std::vector<std::string> filenames(argv + 2, argv + argc);
+        if (filenames.empty()) filenames = { "../StrutWalking/StrutWalking.dae", "../hip_hop/Hip_Hop_Dancing.dae" };
+        return gl::RunChannelBenchmark(filenames);
+    }
+
+    if (std::string(argv[1]) == "--clip-benchmark" && argc > 2)
+    {
+        return gl::RunClipBenchmark(argv[2]);
+    }
+
+    if (std::string(argv[1]) == "--skinning-benchmark" && argc > 2)
+    {
+        return gl::RunSkinningBenchmark(argv[2]);
+    }
+
     gl::Window::initialize(argv[1]);
 
     while (gl::Window::isActive())
@@ -42,11 +42,15 @@ void Shader::shader_errors (const GLuint shader){
     throw std::runtime_error("Compile Error, Log Below: \n" + log + "\n");
 }
 
-GLuint Shader::init_shaders (GLenum type, const char *filename){
+GLuint Shader::init_shaders (GLenum type, const char *filename, const std::string& defines){
     GLuint shader = glCreateShader(type);
     GLint compiled;
 
     std::string str = read_text_file(filename);
+    if (!defines.empty()) {
+        size_t versionEnd = str.find('\n');
+        str.insert(versionEnd == std::string::npos ? str.size() : versionEnd + 1, defines);
+    }
     const char * cstr = str.c_str();
 
     glShaderSource (shader, 1, &cstr, nullptr);
@@ -77,6 +81,37 @@ GLuint Shader::init_program (GLuint vertexshader, GLuint fragmentshader){
     return program;
 }
 
+GLuint Shader::init_feedback_program (GLuint vertexshader, const char * const * varyings, int count){
+    GLint linked;
+    GLuint program = glCreateProgram();
+
+    glAttachShader(program, vertexshader);
+    glTransformFeedbackVaryings(program, count, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked) {
+        program_errors(program);
+        throw std::runtime_error("Transform feedback program did not link correctly!");
+    }
+    return program;
+}
+
+GLuint Shader::init_compute_program (GLuint computeshader){
+    GLint linked;
+    GLuint program = glCreateProgram();
+
+    glAttachShader(program, computeshader);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked) {
+        program_errors(program);
+        throw std::runtime_error("Compute program did not link correctly!");
+    }
+    return program;
+}
+
     GLint Shader::GetUniformLocation(const char* pUniformName, GLuint m_shaderProg) {
     GLuint Location = glGetUniformLocation(m_shaderProg, pUniformName);
 
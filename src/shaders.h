@@ -10,14 +10,18 @@
 #endif
 
 #define INVALID_UNIFORM_LOCATION 0xffffffff
-#define MAX_BONES 200
+#define MAX_BONES 64
 
 namespace gl {
 class Shader{
 public:
     
-    static GLuint init_shaders (GLenum type, const char * filename);
+    // defines go right after the #version line, to compile variants of one source
+    static GLuint init_shaders (GLenum type, const char * filename, const std::string& defines = "");
     static GLuint init_program (GLuint vertexshader, GLuint fragmentshader);
+    // Vertex-only program whose outputs are captured interleaved by transform feedback
+    static GLuint init_feedback_program (GLuint vertexshader, const char * const * varyings, int count);
+    static GLuint init_compute_program (GLuint computeshader);
     static GLint GetUniformLocation(const char* pUniformName, GLuint m_shaderProg);
 
 private:
@@ -0,0 +1,125 @@
+#include "skinningBenchmark.h"
+#include "jobSystem.h"
+#include "animations/skinnedMesh.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace gl {
+
+    static constexpr int WARMUP_FRAMES = 5;
+    static constexpr int FRAMES = 50;
+
+    // Wall time of one crowd draw, glFinish included so GPU work is not left out of the frame
+    static double MeasureFrameMs(SkinnedMesh& Mesh, const glm::mat4& View, const glm::mat4& Proj) {
+        for (int i = 0 ; i < WARMUP_FRAMES ; i++) {
+            Mesh.RenderInstances(View, Proj);
+            glFinish();
+        }
+        auto Start = std::chrono::steady_clock::now();
+        for (int i = 0 ; i < FRAMES ; i++) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            Mesh.RenderInstances(View, Proj);
+            glFinish();
+        }
+        auto End = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(End - Start).count() / FRAMES;
+    }
+
+    static void RunBackends(SkinnedMesh& Mesh, JobSystem& AnimationJobs, unsigned int Instances,
+                            unsigned int MaxThreads) {
+        // One pose per character, evaluated once since only the skinning is measured
+        int Side = (int)std::ceil(std::sqrt((float)Instances));
+        for (unsigned int i = 0 ; i < Instances ; i++) {
+            glm::vec3 Offset(2.0f * (float)((int)i % Side - Side / 2), 0.0f, -2.0f * (float)((int)i / Side));
+            uint Instance = Mesh.CreateInstance(glm::translate(glm::mat4(1.0f), Offset));
+            Mesh.GetInstance(Instance).TimeInSeconds = 0.37 * (double)i;
+        }
+        Mesh.SetAnimationLODs({ AnimationLOD() });
+        Mesh.UpdateInstances(0.0, glm::vec3(0.0f), AnimationJobs);
+
+        glm::mat4 View = glm::lookAt(glm::vec3(0.0f, 2.0f, 6.0f), glm::vec3(0.0f, 0.0f, -(float)Side),
+                                     glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 Proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+
+        printf("backend                ms/frame   GPU ms   CPU skinning ms\n");
+        for (SkinningMode Mode : { SkinningMode::LinearBlend, SkinningMode::DualQuaternion }) {
+            Mesh.SetSkinningMode(Mode);
+            const char* ModeName = Mode == SkinningMode::LinearBlend ? "linear" : "dual quat";
+
+            Mesh.SetSkinningCache(false);
+            double FrameMs = MeasureFrameMs(Mesh, View, Proj);
+            printf("%-9s vertex shader  %8.2f  %7.2f\n", ModeName, FrameMs, Mesh.GetDrawTimeMs());
+
+            Mesh.SetSkinningCache(true);
+            FrameMs = MeasureFrameMs(Mesh, View, Proj);
+            printf("%-9s %-13s  %8.2f  %7.2f\n", ModeName, Mesh.GetSkinningCacheBackend(), FrameMs,
+                   Mesh.GetDrawTimeMs());
+
+            for (unsigned int Threads = 1 ; Threads <= MaxThreads ; Threads++) {
+                JobSystem CpuJobs((int)Threads - 1);
+                Mesh.SetSkinningCache(true, &CpuJobs);
+                FrameMs = MeasureFrameMs(Mesh, View, Proj);
+                printf("%-9s CPU x%-2u %-6s  %8.2f  %7.2f  %8.2f\n", ModeName, Threads,
+                       BoneKernels::GetInstructionSet(), FrameMs, Mesh.GetDrawTimeMs(), Mesh.GetCpuSkinningMs());
+                Mesh.SetSkinningCache(false);
+            }
+        }
+    }
+
+    int RunSkinningBenchmark(const std::string& Filename, unsigned int Instances, unsigned int MaxThreads) {
+        if (MaxThreads == 0) MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        // A hidden window is enough for a context, so this also runs on headless nodes with a
+        // software rasterizer
+        if (!glfwInit()) return -1;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow* pWindow = glfwCreateWindow(1280, 720, "Skinning benchmark", nullptr, nullptr);
+        if (!pWindow) {
+            fprintf(stderr, "Failed to create GLFW window\n");
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(pWindow);
+        glfwSwapInterval(0);
+
+        glewExperimental = GL_TRUE;
+        if (glewInit() != GLEW_OK) {
+            fprintf(stderr, "GLEW Initialization Failed\n");
+            glfwDestroyWindow(pWindow);
+            glfwTerminate();
+            return -1;
+        }
+        printf("OpenGL %s, %s\n", (const char*)glGetString(GL_VERSION), (const char*)glGetString(GL_RENDERER));
+        glViewport(0, 0, 1280, 720);
+        glEnable(GL_DEPTH_TEST);
+
+        int Result = 0;
+        {
+            // Destroyed before the context goes away
+            SkinnedMesh Mesh;
+            JobSystem AnimationJobs;
+            if (!Mesh.init() || !Mesh.LoadMesh(Filename) || Mesh.NumAnimations() == 0) {
+                fprintf(stderr, "Could not load an animated mesh from '%s'\n", Filename.c_str());
+                Result = -1;
+            } else {
+                printf("%s: %u bones, %u characters\n", Filename.c_str(), Mesh.NumBones(), Instances);
+                RunBackends(Mesh, AnimationJobs, Instances, MaxThreads);
+            }
+        }
+
+        glfwDestroyWindow(pWindow);
+        glfwTerminate();
+        return Result;
+    }
+}
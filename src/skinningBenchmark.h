@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+namespace gl {
+    // Skinning backends compared on one model, run with `viewer --skinning-benchmark model.dae`.
+    // Draws a crowd of Instances characters offscreen with the vertex shader, the GPU skinning
+    // cache and the CPU skinning cache from one thread up to MaxThreads (0 for every hardware
+    // thread), and prints the time per frame of each.
+    int RunSkinningBenchmark(const std::string& Filename, unsigned int Instances = 64, unsigned int MaxThreads = 0);
+}
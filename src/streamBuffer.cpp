@@ -0,0 +1,89 @@
+#include "streamBuffer.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace gl {
+
+    StreamBuffer::~StreamBuffer() { Release(); }
+
+    unsigned char* StreamBuffer::Map(size_t Bytes) {
+        // Everything reading the region written last frame has been issued by now
+        if (m_Buffer != 0) m_Fences[m_Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        if (m_Buffer == 0 || Bytes > m_RegionSize) {
+            // Grows geometrically so a growing crowd does not reallocate every frame
+            Allocate(std::max(Bytes, m_RegionSize * 2));
+        } else {
+            m_Region = (m_Region + 1) % STREAM_BUFFER_FRAMES;
+        }
+        m_Frame++;
+
+        if (m_Fences[m_Region]) {
+            // Only waits when the CPU is more than STREAM_BUFFER_FRAMES - 1 frames ahead of the GPU
+            while (glClientWaitSync(m_Fences[m_Region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(m_Fences[m_Region]);
+            m_Fences[m_Region] = nullptr;
+        }
+
+        if (m_pPersistent) {
+            m_pMapped = m_pPersistent + m_Region * m_RegionSize;
+        } else {
+            // The fence already guarantees the GPU is done with the region, and leaving out
+            // invalidation keeps what it held
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+            GLbitfield Access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+            m_pMapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, GetOffset(), (GLsizeiptr)m_RegionSize,
+                                                         Access);
+        }
+        return m_pMapped;
+    }
+
+    void StreamBuffer::Flush(size_t Offset, size_t Bytes) {
+        // Coherent persistent mappings need no flush
+        if (m_pPersistent || Bytes == 0) return;
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, (GLintptr)Offset, (GLsizeiptr)Bytes);
+    }
+
+    void StreamBuffer::Unmap() {
+        m_RegionFrames[m_Region] = m_Frame;
+        if (m_pPersistent) return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        m_pMapped = nullptr;
+    }
+
+    void StreamBuffer::Allocate(size_t RegionSize) {
+        Release();
+        m_RegionSize = RegionSize;
+        m_Region = 0;
+        std::fill(std::begin(m_RegionFrames), std::end(m_RegionFrames), 0);
+        glGenBuffers(1, &m_Buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+
+        GLsizeiptr Size = (GLsizeiptr)(RegionSize * STREAM_BUFFER_FRAMES);
+        if (GLEW_ARB_buffer_storage) {
+            GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, Size, nullptr, Flags);
+            m_pPersistent = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, Size, Flags);
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, Size, nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+
+    void StreamBuffer::Release() {
+        if (m_Buffer == 0) return;
+        for (GLsync& Fence : m_Fences) {
+            if (Fence) glDeleteSync(Fence);
+            Fence = nullptr;
+        }
+        if (m_pPersistent) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            m_pPersistent = nullptr;
+        }
+        // Draws still reading the old store keep it alive, the driver frees it after them
+        glDeleteBuffers(1, &m_Buffer);
+        m_Buffer = 0;
+    }
+}
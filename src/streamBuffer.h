@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+
+#define STREAM_BUFFER_FRAMES 3
+
+namespace gl {
+    // Buffer written every frame, for data the GPU reads once such as bone palettes. It is split
+    // in STREAM_BUFFER_FRAMES regions used in turn, and a region is only written again once the
+    // fence of the frame that last used it has passed. With ARB_buffer_storage the buffer stays
+    // persistently mapped, otherwise each region is mapped unsynchronized for the frame.
+    //
+    // A region keeps what was written to it STREAM_BUFFER_FRAMES frames ago, so callers that know
+    // what changed since GetRegionFrame() only need to write and flush that.
+    class StreamBuffer {
+    public:
+        StreamBuffer() = default;
+        ~StreamBuffer();
+
+        StreamBuffer(const StreamBuffer&) = delete;
+        StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+        // Starts the next frame with room for Bytes, call once per frame
+        unsigned char* Map(size_t Bytes);
+        // Every range written since Map must be flushed before Unmap, Offset is from the pointer Map
+        // returned
+        void Flush(size_t Offset, size_t Bytes);
+        // Makes the flushed writes visible, must be called before drawing with the buffer
+        void Unmap();
+
+        GLuint GetBuffer() const { return m_Buffer; }
+        // Where the region returned by the last Map starts in the buffer
+        GLintptr GetOffset() const { return (GLintptr)(m_Region * m_RegionSize); }
+        bool IsPersistent() const { return m_pPersistent != nullptr; }
+        // Frames are numbered from 1 by Map. GetRegionFrame is the frame that last wrote the
+        // current region, 0 when its contents are undefined.
+        uint64_t GetFrame() const { return m_Frame; }
+        uint64_t GetRegionFrame() const { return m_RegionFrames[m_Region]; }
+
+    private:
+        void Allocate(size_t RegionSize);
+        void Release();
+
+        GLuint m_Buffer = 0;
+        size_t m_RegionSize = 0;
+        unsigned int m_Region = 0;
+        unsigned char* m_pPersistent = nullptr;
+        unsigned char* m_pMapped = nullptr;     // the current region while it is mapped
+        GLsync m_Fences[STREAM_BUFFER_FRAMES] = {};
+        uint64_t m_Frame = 0;
+        uint64_t m_RegionFrames[STREAM_BUFFER_FRAMES] = {};
+    };
+}
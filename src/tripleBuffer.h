@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace gl {
+    // Hands the latest value from one writer thread to one reader thread without either of them
+    // ever waiting. The writer fills its back slot and publishes it, the reader picks up the most
+    // recently published slot. A value published twice before the reader looks is skipped, and the
+    // reader keeps its current value while nothing new has been published.
+    template<typename T>
+    class TripleBuffer {
+    public:
+        // Writer side. The slot holds whatever was published two or more values ago.
+        T& GetWriteBuffer() { return m_Slots[m_Back]; }
+        void Publish() {
+            uint8_t Previous = m_Middle.exchange(m_Back | FRESH, std::memory_order_acq_rel);
+            m_Back = Previous & INDEX_MASK;
+        }
+
+        // Reader side. Returns true when a newer value than the current read buffer was taken.
+        bool Acquire() {
+            if ((m_Middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+            uint8_t Previous = m_Middle.exchange(m_Front, std::memory_order_acq_rel);
+            m_Front = Previous & INDEX_MASK;
+            return true;
+        }
+        T& GetReadBuffer() { return m_Slots[m_Front]; }
+
+    private:
+        static constexpr uint8_t INDEX_MASK = 3;
+        static constexpr uint8_t FRESH = 4;
+
+        T m_Slots[3];
+        // Index of the slot in between, FRESH when it was published after the reader last took one
+        alignas(64) std::atomic<uint8_t> m_Middle{1};
+        alignas(64) uint8_t m_Back = 0;    // writer only
+        alignas(64) uint8_t m_Front = 2;   // reader only
+    };
+}
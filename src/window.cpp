@@ -1,4 +1,7 @@
 
+#include <algorithm>
+#include <array>
+#include <thread>
 #include <vector>
 #include <GL/glew.h>
 #include <glm/gtc/type_ptr.hpp>
@@ -7,6 +10,7 @@
 #include "shaders.h"
 #include "mesh.h"
 #include "camera.h"
+#include "allocationCounter.h"
 #include <imgui.h>
 
 #include "imgui/backends/imgui_impl_glfw.h"
@@ -20,6 +24,22 @@ glm::vec4 light_color(1.0f, 0.0f, 0.0f, 1.0f);
 int sAnim = 0;
 int eAnim = 0;
 float blendFact = 0.5f;
+int crowdSize = 0;
+unsigned int crowdEvaluated = 0;
+bool dualQuaternionSkinning = false;
+bool skinningCache = false;
+bool cpuSkinning = false;
+bool instancedCrowd = true;
+bool poseCache = false;
+bool pauseAnimation = false;
+float animationSpeed = 1.0f;
+// Advances animation by exactly 1/60 s per frame so runs and captures replay identically
+bool fixedAnimationStep = false;
+bool restartAnimation = false;
+// The animation and skinned draw part of a frame must not allocate once warmed up (debug builds)
+gl::AllocationCheck frameAllocations("Animation frame");
+float skinningMaxError = 0.0f;
+float skinningMeanError = 0.0f;
 
 namespace gl {
 
@@ -38,6 +58,8 @@ namespace gl {
     std::vector<gl::DataTex> Window::m_data = std::vector<gl::DataTex>();
     GLFWwindow* Window::glfwWindow = nullptr;
     SkinnedMesh Window::sMesh = SkinnedMesh();
+    // At least one worker even on a single core, the crowd update must never run on the GL thread
+    JobSystem Window::jobSystem(std::max(1, (int)std::thread::hardware_concurrency() - 1));
 
     Window::~Window() {
         if (glfwWindow) {
@@ -182,6 +204,7 @@ namespace gl {
 
 
         sMesh.init();
+        sMesh.SetClipCompression(0.01f, 0.002f);
         // sMesh.LoadMesh("../hip_hop/Hip_Hop_Dancing.dae");
         // sMesh.LoadMesh("../StrutWalking/StrutWalking.dae");
         sMesh.LoadMesh(filename);
@@ -288,7 +311,75 @@ namespace gl {
           glm::radians(180.0f), glm::vec3(1,0,-1)
         );
         model = glm::translate(model, glm::vec3(-100.0f, 50.0f, 500.0f));
-        sMesh.Render(model, view, proj, true, sAnim, eAnim, blendFact);
+        // The crowd update started last frame ran while that frame was drawn. It is waited for here,
+        // a frame later, since everything below changes state it reads.
+        static Job* crowdJob = nullptr;
+        static unsigned int evaluated = 0;
+        if (crowdJob) {
+            jobSystem.Wait(crowdJob);
+            crowdJob = nullptr;
+            crowdEvaluated = evaluated;
+        }
+
+        // Switched here, before the crowd job starts, since the mode decides what UpdateInstances produces
+        sMesh.SetSkinningMode(dualQuaternionSkinning ? SkinningMode::DualQuaternion : SkinningMode::LinearBlend);
+        // CPU skinning fills the cache too, it only runs on the main thread outside of the crowd job
+        sMesh.SetSkinningCache(skinningCache || cpuSkinning, cpuSkinning ? &jobSystem : nullptr);
+        sMesh.SetPoseCache(ANIMATION_SAMPLE_RATE, poseCache ? 64u << 20 : 0);
+        sMesh.SetInstancedDrawing(instancedCrowd);
+
+        // Ticked once per frame, both the single character and the crowd playheads follow it
+        AnimationClock& clock = sMesh.GetClock();
+        clock.SetPaused(pauseAnimation);
+        clock.SetTimeScale(animationSpeed);
+        clock.SetFixedStep(fixedAnimationStep ? 1.0 / 60.0 : 0.0);
+        if (restartAnimation) {
+            // The crowd is rebuilt below with its initial phases
+            clock.Reset();
+            sMesh.ClearInstances();
+            frameAllocations.Reset();
+            restartAnimation = false;
+        }
+        double animationDelta = clock.Tick();
+
+        // Any of these may resize buffers once, the allocation check warms up again after a change
+        static std::array<int, 8> lastSettings = {};
+        std::array<int, 8> settings = { sAnim, eAnim, crowdSize, dualQuaternionSkinning, skinningCache, cpuSkinning,
+                                        poseCache, instancedCrowd };
+        if (settings != lastSettings) {
+            frameAllocations.Reset();
+            lastSettings = settings;
+        }
+        frameAllocations.Begin();
+
+        if (crowdSize > 0 && sMesh.NumAnimations() > 0) {
+            // Lay the crowd out on a square grid around the single character, each one a little out of phase
+            if ((int)sMesh.NumInstances() != crowdSize) {
+                sMesh.ClearInstances();
+                int side = (int)std::ceil(std::sqrt((float)crowdSize));
+                for (int i = 0; i < crowdSize; i++) {
+                    glm::vec3 offset(200.0f * (float)(i % side - side / 2), 0.0f, 200.0f * (float)(i / side));
+                    uint instance = sMesh.CreateInstance(glm::translate(model, offset));
+                    sMesh.GetInstance(instance).TimeInSeconds = 0.37 * (double)i;
+                }
+            }
+            uint lastAnim = sMesh.NumAnimations() - 1;
+            for (uint i = 0; i < sMesh.NumInstances(); i++) {
+                AnimationInstance& instance = sMesh.GetInstance(i);
+                instance.StartAnimIndex = std::min((uint)sAnim, lastAnim);
+                instance.EndAnimIndex = std::min((uint)eAnim, lastAnim);
+                instance.BlendFactor = blendFact;
+            }
+            // Animate the next frame in the background, this one draws the last published poses. Kept
+            // off this thread's deque, or the CPU skinning wait in RenderInstances could pick it up.
+            glm::vec3 cameraPos = gl::Camera::get_position();
+            crowdJob = jobSystem.CreateJob([animationDelta, cameraPos] {
+                evaluated = sMesh.UpdateInstances(animationDelta, cameraPos, jobSystem);
+            });
+            jobSystem.RunOnWorker(crowdJob);
+        } else {
+            sMesh.Render(model, view, proj, true, sAnim, eAnim, blendFact);
+        }
         ImGui::Begin("Object Properties");
         ImGui::Text("Application %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::Text(" ");
@@ -343,10 +434,41 @@ namespace gl {
         ImGui::SliderInt("Starting Animation: ", &sAnim, 0, 3);
         ImGui::SliderInt("Ending Animation: ", &eAnim, 0, 3);
         ImGui::SliderFloat("Blend Factor: ", &blendFact, 0.0f, 1.0f);
+        ImGui::SliderInt("Crowd size: ", &crowdSize, 0, 500);
+        ImGui::Checkbox("Pause", &pauseAnimation); ImGui::SameLine();
+        ImGui::Checkbox("Fixed step", &fixedAnimationStep); ImGui::SameLine();
+        if (ImGui::Button("Restart")) restartAnimation = true;
+        ImGui::SliderFloat("Animation speed: ", &animationSpeed, 0.0f, 4.0f);
+        ImGui::Text("Animation time: %.3f s", sMesh.GetClock().GetTime());
+        ImGui::Text("Animation threads: %u", jobSystem.NumThreads());
+        if (crowdSize > 0) ImGui::Text("Poses evaluated last frame: %u / %d", crowdEvaluated, crowdSize);
+        ImGui::Checkbox("Instanced crowd", &instancedCrowd); ImGui::SameLine();
+        ImGui::Text("%u draw calls", sMesh.GetNumDrawCalls());
+        ImGui::Checkbox("Pose cache", &poseCache); ImGui::SameLine();
+        ImGui::Text("%.2f MB", (double)sMesh.GetPoseCacheBytes() / (1024.0 * 1024.0));
+        ImGui::Checkbox("Dual quaternion skinning", &dualQuaternionSkinning);
+        ImGui::Checkbox("Skinning cache", &skinningCache); ImGui::SameLine();
+        ImGui::Text("(%s)", sMesh.GetSkinningCacheBackend());
+        ImGui::Checkbox("CPU skinning", &cpuSkinning); ImGui::SameLine();
+        ImGui::Text("%.3f ms (%s)", sMesh.GetCpuSkinningMs(), BoneKernels::GetInstructionSet());
+        ImGui::Text("Skinned draw: %.3f ms GPU, palette %u bytes/character in %u partitions", sMesh.GetDrawTimeMs(),
+                    sMesh.GetNumPaletteEntries() * (dualQuaternionSkinning ? 8u : 12u) * (unsigned int)sizeof(float),
+                    sMesh.GetNumPalettePartitions());
+        ImGui::Text("Palette upload: %.1f KB/frame, %u static clip bones",
+                    (double)sMesh.GetPaletteUploadBytes() / 1024.0, sMesh.GetNumStaticBones());
+        if (ImGui::Button("Compare with linear blend")) {
+            sMesh.MeasureSkinningError(skinningMaxError, skinningMeanError);
+            frameAllocations.Reset();
+        }
+        ImGui::Text("Dual quaternion vs linear: max %.3f, mean %.4f", skinningMaxError, skinningMeanError);
 
         ////////////////////////////////////////////////////////////////////////////////////////////////
 
         ImGui::End();
+
+        if (crowdJob) sMesh.RenderInstances(view, proj);
+        frameAllocations.End();
+
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glViewport(current_vp_width, 0, window_width - current_vp_width, window_height);
@@ -356,5 +478,10 @@ namespace gl {
         glfwSwapBuffers(glfwWindow);
 
         glfwPollEvents();
+        // Nothing may be left running on the mesh once the loop in main stops calling update
+        if (crowdJob && glfwWindowShouldClose(glfwWindow)) {
+            jobSystem.Wait(crowdJob);
+            crowdJob = nullptr;
+        }
     }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "mesh.h"
 #include "animations/skinnedMesh.h"
+#include "jobSystem.h"
 #include <GLFW/glfw3.h>
 
 namespace gl {
@@ -35,5 +36,6 @@ private:
     static GLFWwindow* glfwWindow;
     static std::vector<gl::DataTex> m_data;
     static SkinnedMesh sMesh;
+    static JobSystem jobSystem;
 };
 }
\ No newline at end of file